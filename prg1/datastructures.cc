@@ -64,7 +64,7 @@ bool Datastructures::add_beacon(BeaconID newId, const std::string& newName, Coor
     if (allBeacons.find(newId) != allBeacons.end()){
         return false;
     }
-    Beacon b = Beacon{newId, xy, newName, newColor, nullptr, {}};
+    Beacon b = Beacon{newId, xy, newName, newColor, nullptr, {}, 0, 0, 1, nullptr};
     allBeacons[newId] = b;
     update_brightness(newId);
     beaconNames.insert({newName, newId});
@@ -200,13 +200,33 @@ bool Datastructures::change_beacon_color(BeaconID id, Color newcolor)
 }
 
 //Lisää valonsäteen majakasta toiseen. Majakka voi lähettää valoa vain yhdelle toiselle majakalle.
-//Työssä saa olettaa, että valonsäteet eivät voi muodostaa silmukoita (ts. majakka ei voi suoraan tai epäsuorasti valaista itseään).
-//Jos jompaa kumpaa majakkaa ei löydy tai lähdemajakka lähettää jo valoa toiselle majakalle, ei tehdä mitään ja palautetaan false. Muuten palautetaan true.
+//Säde, joka muodostaisi silmukan (ts. majakka valaisisi suoraan tai epäsuorasti itseään), hylätään.
+//Jos jompaa kumpaa majakkaa ei löydy, lähdemajakka lähettää jo valoa toiselle majakalle tai säde sulkisi silmukan,
+//ei tehdä mitään ja palautetaan false. Muuten palautetaan true.
 bool Datastructures::add_lightbeam(BeaconID sourceid, BeaconID targetid)
 {
-    if (allBeacons.find(sourceid) != allBeacons.end() and allBeacons.find(targetid) != allBeacons.end() and allBeacons.at(sourceid).sending == nullptr) {
-        allBeacons.at(targetid).receiving.push_back(std::make_shared<Beacon>(allBeacons.at(sourceid)));
-        allBeacons.at(sourceid).sending = std::make_shared<Beacon>(allBeacons.at(targetid));
+    auto source = allBeacons.find(sourceid);
+    auto target = allBeacons.find(targetid);
+    if (source != allBeacons.end() and target != allBeacons.end() and source->second.sending == nullptr) {
+        // Lähde ei lähetä valoa, joten silmukka syntyy täsmälleen silloin, kun kohteen ketju päättyy lähteeseen
+        for (Beacon* current = &target->second; current != nullptr; current = current->sending) {
+            if (current == &source->second) {
+                return false;
+            }
+        }
+        source->second.sending = &target->second;
+        source->second.receivingPos = target->second.receiving.size();
+        target->second.receiving.push_back(&source->second);
+
+        // Pidempi tuleva ketju kasvattaa kohteiden ketjuja niin kauan kuin se on pisin
+        Beacon* from = &source->second;
+        Beacon* to = &target->second;
+        while (to != nullptr and from->inbeamHeight + 1 > to->inbeamHeight) {
+            to->inbeamHeight = from->inbeamHeight + 1;
+            to->longestSource = from;
+            from = to;
+            to = to->sending;
+        }
         return true;
     }
     return false;
@@ -217,9 +237,9 @@ bool Datastructures::add_lightbeam(BeaconID sourceid, BeaconID targetid)
 std::vector<BeaconID> Datastructures::get_lightsources(BeaconID id)
 {
     std::vector<BeaconID> ids;
-    if (allBeacons.find(id) != allBeacons.end()) {
-        std::vector<std::shared_ptr<Beacon>> beams = allBeacons.at(id).receiving;
-        for (auto beam :  beams) {
+    auto beacon = allBeacons.find(id);
+    if (beacon != allBeacons.end()) {
+        for (auto beam : beacon->second.receiving) {
             ids.push_back(beam->id);
         }
         std::sort(ids.begin(), ids.end());
@@ -228,13 +248,13 @@ std::vector<BeaconID> Datastructures::get_lightsources(BeaconID id)
     return {{NO_ID}};
 }
 
-std::vector<BeaconID> Datastructures::path_recursive(BeaconID id)
+std::vector<BeaconID> Datastructures::path_recursive(Beacon const& beacon)
 {
     std::vector<BeaconID> outbeams;
-    if (allBeacons.at(id).sending != nullptr) {
-        outbeams = path_recursive(allBeacons.at(id).sending->id);
+    if (beacon.sending != nullptr) {
+        outbeams = path_recursive(*beacon.sending);
     }
-    outbeams.push_back(id);
+    outbeams.push_back(beacon.id);
     return outbeams;
 }
 
@@ -243,10 +263,11 @@ std::vector<BeaconID> Datastructures::path_recursive(BeaconID id)
 //niin kauan kuin valonsäteitä riittää. Jos id:llä ei ole majakkaa, palautetaan vektori, jonka ainoa alkio on NO_ID.
 std::vector<BeaconID> Datastructures::path_outbeam(BeaconID id)
 {
-    if (allBeacons.find(id) == allBeacons.end()) {
+    auto beacon = allBeacons.find(id);
+    if (beacon == allBeacons.end()) {
         return {{NO_ID}};
     }
-    std::vector<BeaconID> beams = path_recursive(id);
+    std::vector<BeaconID> beams = path_recursive(beacon->second);
     std::reverse(beams.begin(), beams.end());
     return beams;
 }
@@ -274,40 +295,82 @@ bool Datastructures::remove_beacon(BeaconID id)
             break;
         }
     }
-    if (allBeacons.at(id).sending != nullptr) {
-        std::shared_ptr<Beacon> target = allBeacons.at(id).sending;
-        std::shared_ptr<Beacon> source = std::make_shared<Beacon>(allBeacons.at(id));
-        allBeacons.at(target->id).receiving.erase(std::remove(allBeacons.at(target->id).receiving.begin(),
-                                                              allBeacons.at(target->id).receiving.end(), source));
-    }
-    if (!allBeacons.at(id).receiving.empty()) {
-        for (auto beacon : allBeacons.at(id).receiving) {
-            allBeacons.at(beacon->id).sending = nullptr;
+    Beacon& beacon = allBeacons.at(id);
+    if (beacon.sending != nullptr) {
+        // Siirretään kohteen viimeinen lähde poistettavan paikalle, jolloin poisto on O(1)
+        std::vector<Beacon*>& receiving = beacon.sending->receiving;
+        receiving[beacon.receivingPos] = receiving.back();
+        receiving[beacon.receivingPos]->receivingPos = beacon.receivingPos;
+        receiving.pop_back();
+        if (beacon.sending->longestSource == &beacon) {
+            update_inbeam_height(beacon.sending);
         }
     }
+    for (auto source : beacon.receiving) {
+        source->sending = nullptr;
+    }
     allBeacons.erase(id);
     return true;
 }
 
-std::vector<BeaconID> Datastructures::path_inbeam_longest(BeaconID /*id*/)
+//Palauttaa pisimmän majakkaketjun, jota pitkin valo tulee annettuun majakkaan. Ensimmäisenä on ketjun alku
+//ja viimeisenä majakka itse. Jos id:llä ei ole majakkaa, palautetaan vektori, jonka ainoa alkio on NO_ID.
+std::vector<BeaconID> Datastructures::path_inbeam_longest(BeaconID id)
 {
-    return {{NO_ID}};
+    auto beacon = allBeacons.find(id);
+    if (beacon == allBeacons.end()) {
+        return {{NO_ID}};
+    }
+    // Ketjun pituus tiedetään, joten polku kirjoitetaan suoraan lopusta alkuun
+    std::vector<BeaconID> path(beacon->second.inbeamHeight);
+    Beacon const* current = &beacon->second;
+    for (auto it = path.rbegin(); it != path.rend(); ++it) {
+        *it = current->id;
+        current = current->longestSource;
+    }
+    return path;
+}
+
+// Lasketaan majakan pisin tuleva ketju uudelleen sen lähteistä. Jos ketju lyheni ja majakka oli
+// kohteensa pisimmän ketjun lähde, myös kohde lasketaan uudelleen.
+void Datastructures::update_inbeam_height(Beacon* beacon)
+{
+    while (beacon != nullptr) {
+        int height = 1;
+        Beacon* longest = nullptr;
+        for (auto source : beacon->receiving) {
+            if (source->inbeamHeight + 1 > height) {
+                height = source->inbeamHeight + 1;
+                longest = source;
+            }
+        }
+        beacon->longestSource = longest;
+        if (height == beacon->inbeamHeight) {
+            break;
+        }
+        beacon->inbeamHeight = height;
+
+        if (beacon->sending == nullptr or beacon->sending->longestSource != beacon) {
+            break;
+        }
+        beacon = beacon->sending;
+    }
 }
 
-Color Datastructures::color_recursive(BeaconID id)
+Color Datastructures::color_recursive(Beacon const& beacon)
 {
-    Color thisColor = allBeacons.at(id).color;
+    Color thisColor = beacon.color;
 
-    if (allBeacons.at(id).receiving.empty()) {
-        return allBeacons.at(id).color;
+    if (beacon.receiving.empty()) {
+        return beacon.color;
     }
-    for (auto beacon : allBeacons.at(id).receiving) {
-            Color someColor = color_recursive(beacon->id);
+    for (auto source : beacon.receiving) {
+            Color someColor = color_recursive(*source);
             thisColor.r += someColor.r;
             thisColor.g += someColor.g;
             thisColor.b += someColor.b;
     }
-    int divider = static_cast<int>(allBeacons.at(id).receiving.size()+1);
+    int divider = static_cast<int>(beacon.receiving.size()+1);
     int newR = thisColor.r / divider;
     int newG = thisColor.g / divider;
     int newB = thisColor.b / divider;
@@ -319,8 +382,9 @@ Color Datastructures::color_recursive(BeaconID id)
 //Jos id:lläei löydy majakkaa, palautetaan NO_COLOR.
 Color Datastructures::total_color(BeaconID id)
 {
-    if (allBeacons.find(id) == allBeacons.end()) {
+    auto beacon = allBeacons.find(id);
+    if (beacon == allBeacons.end()) {
         return NO_COLOR;
     }
-    return color_recursive(id);
+    return color_recursive(beacon->second);
 }
@@ -86,9 +86,16 @@ struct Beacon {
     Coord coord = NO_COORD;
     std::string name = NO_NAME;
     Color color = NO_COLOR;
-    std::shared_ptr<Beacon> sending = nullptr;
-    std::vector<std::shared_ptr<Beacon>> receiving = {};
+    // Pointers to unordered_map's elements stay valid even when the map rehashes
+    Beacon* sending = nullptr;
+    std::vector<Beacon*> receiving = {};
     int brightness = 0;
+    // Position of this beacon in the receiving vector of the beacon it sends to
+    std::size_t receivingPos = 0;
+    // Number of beacons on the longest incoming chain (including this beacon)
+    // and the source that continues that chain
+    int inbeamHeight = 1;
+    Beacon* longestSource = nullptr;
 
 };
 
@@ -156,8 +163,9 @@ public:
     // Short rationale for estimate: equal_range logn, for looppi m, poisto n, lisäys multimappiin logn, loput O(1)
     bool change_beacon_color(BeaconID id, Color newcolor);
 
-    // Estimate of performance: O(1)
-    // Short rationale for estimate: kaikki operaatiot O(1)
+    // Estimate of performance: O(d)
+    // Short rationale for estimate: silmukan tarkistus kulkee kohteen lähtevän ketjun d, säteen lisäys O(1),
+    // tulevan ketjun pituuden muutos välitetään säteiden ketjua pitkin d
     bool add_lightbeam(BeaconID sourceid, BeaconID targetid);
 
     // Estimate of performance: O(m+nlogn)
@@ -168,13 +176,14 @@ public:
     // Short rationale for estimate: vectorin järjestäminen O(n)
     std::vector<BeaconID> path_outbeam(BeaconID id);
 
-    // Estimate of performance: tiivistettynä O(logn+n)
-    // Short rationale for estimate: equal_range logn, for loopit m+n+o,
-    // poistot 1 (unordered_map) ja logn (multimap), loput O(1)
+    // Estimate of performance: tiivistettynä O(logn+n+dk)
+    // Short rationale for estimate: equal_range logn, for loopit m+n, säteen poisto kohteelta O(1),
+    // poistot 1 (unordered_map) ja logn (multimap), pisimmän tulevan ketjun uudelleenlaskenta
+    // käy läpi muuttuvien kohteiden lähteet k
     bool remove_beacon(BeaconID id);
 
-    // Estimate of performance:
-    // Short rationale for estimate:
+    // Estimate of performance: O(k)
+    // Short rationale for estimate: seurataan pisimmän tulevan ketjun osoittimia, k on polun pituus
     std::vector<BeaconID> path_inbeam_longest(BeaconID id);
 
     // Estimate of performance: O(1)
@@ -192,12 +201,18 @@ private:
     // Rekursiivinen funktio valonsäteiden selvittämiseen
     // Estimate of performance: O(n)
     // Short rationale for estimate: rekursiivinen funktio, jossa alkioita lisätään vectorin loppuun O(1)
-    std::vector<BeaconID> path_recursive(BeaconID);
+    std::vector<BeaconID> path_recursive(Beacon const& beacon);
+
+    // Funktio pisimmän tulevan ketjun päivittämiseen, kun majakan lähteistä on poistettu pisimmän ketjun lähde
+    // Estimate of performance: O(dk)
+    // Short rationale for estimate: lasketaan uudestaan vain ne kohteet, joiden pisin ketju muuttuu,
+    // jokaisen lähteet k käydään läpi
+    void update_inbeam_height(Beacon* beacon);
 
     // Rekursiivinen funktio majakoiden värien laskemiseen
     // Estimate of performance: O(n)
     // Short rationale for estimate: rekursiivinen funktio, jossa mahdollisen vectorin läpikäynti O(n) ja laskutoimitukset O(1)
-    Color color_recursive(BeaconID);
+    Color color_recursive(Beacon const& beacon);
 
     // Unordered_map for saving all beacons' data
     std::unordered_map<BeaconID, Beacon> allBeacons;
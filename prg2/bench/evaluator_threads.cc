@@ -0,0 +1,112 @@
+// Standalone benchmark for the threaded recompute_inbeam_caches. Builds star, random and chain forests
+// with add_lightbeams at 1, 2, 4 and 8 evaluator threads, and checks that total colors and inbeam
+// lengths match the serial run (1 thread) for every beacon.
+//
+// Compile from the prg2 directory, for example:
+//   g++ -std=c++17 -O2 -pthread -fPIC -I. $(pkg-config --cflags --libs Qt5Core)
+//       bench/evaluator_threads.cc datastructures.cc -o evaluator_threads
+// Usage: evaluator_threads [beacons] [rounds]. The defaults are 1000000 beacons and 3 rounds, the
+// fastest round is reported.
+
+#include "datastructures.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+enum class Shape { Star, Random, Chain };
+
+char const* shape_name(Shape shape)
+{
+    switch (shape) {
+    case Shape::Star: return "star";
+    case Shape::Random: return "random";
+    case Shape::Chain: return "chain";
+    }
+    return "";
+}
+
+// Star: 64 hubs sending to beacon 0, every other beacon sends to one of the hubs.
+// Random: every beacon sends to a random earlier beacon. Chain: every beacon sends to the previous one.
+std::vector<std::pair<BeaconID, BeaconID>> make_beams(Shape shape, std::vector<BeaconSpec> const& specs,
+                                                      std::mt19937& random)
+{
+    std::vector<std::pair<BeaconID, BeaconID>> beams;
+    beams.reserve(specs.size());
+    for (std::size_t i = 1; i < specs.size(); ++i) {
+        std::size_t target = 0;
+        switch (shape) {
+        case Shape::Star: target = i < 64 ? 0 : random() % 64; break;
+        case Shape::Random: target = random() % i; break;
+        case Shape::Chain: target = i - 1; break;
+        }
+        beams.emplace_back(specs[i].id, specs[target].id);
+    }
+    return beams;
+}
+}
+
+int main(int argc, char* argv[])
+{
+    std::size_t n = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+    int rounds = argc > 2 ? std::atoi(argv[2]) : 3;
+    if (n < 2 or rounds < 1) {
+        std::cerr << "Usage: " << argv[0] << " [beacons >= 2] [rounds >= 1]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::mt19937 random(11);
+    std::vector<BeaconSpec> specs;
+    specs.reserve(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        Coord xy{int(i % 1000), int(i / 1000)};
+        Color color{int(random() % 256), int(random() % 256), int(random() % 256)};
+        specs.push_back({"b" + std::to_string(i), "beacon", xy, color});
+    }
+
+    bool allSame = true;
+    for (Shape shape : {Shape::Star, Shape::Random, Shape::Chain}) {
+        auto beams = make_beams(shape, specs, random);
+        ForestReport serial;
+        double serialMs = 0;
+        for (unsigned threads : {1u, 2u, 4u, 8u}) {
+            double bestMs = 0;
+            bool same = true;
+            for (int round = 0; round < rounds; ++round) {
+                Datastructures ds;
+                ds.set_evaluator_threads(threads);
+                ds.add_beacons(specs);
+                auto start = Clock::now();
+                ds.add_lightbeams(beams);
+                double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+                bestMs = round == 0 ? ms : std::min(bestMs, ms);
+
+                ForestReport report = ds.forest_report();
+                if (threads == 1 and round == 0) {
+                    serial = std::move(report);
+                }
+                else if (report.ids != serial.ids or report.totalColors != serial.totalColors or
+                         report.inbeamLengths != serial.inbeamLengths) {
+                    same = false;
+                }
+            }
+            if (threads == 1) {
+                serialMs = bestMs;
+            }
+            allSame = allSame and same;
+            std::cout << shape_name(shape) << " n=" << n << " threads=" << threads << ": add_lightbeams "
+                      << bestMs << " ms, speedup " << serialMs / bestMs << "x, "
+                      << (same ? "same as serial" : "DIFFERS FROM SERIAL") << std::endl;
+        }
+    }
+    return allSame ? EXIT_SUCCESS : EXIT_FAILURE;
+}
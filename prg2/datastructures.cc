@@ -8,6 +8,21 @@
 #include <iterator>
 #include <list>
 #include <unordered_map>
+#include <unordered_set>
+#include <new>
+#include <cstring>
+#include <cstddef>
+#include <mutex>
+#include <shared_mutex>
+#include <fstream>
+#include <thread>
+#include <atomic>
+#ifdef __unix__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 #include <QDebug>
 
 std::minstd_rand rand_engine; // Reasonably quick pseudo-random generator
@@ -28,424 +43,3686 @@ Type random_in_range(Type start, Type end)
 // an operation (Commenting out parameter name prevents compiler from
 // warning about unused parameters on operations you haven't yet implemented.)
 
-Datastructures::Datastructures()
-{}
-
-Datastructures::~Datastructures()
-{}
+namespace
+{
 
-int Datastructures::beacon_count()
+// Kirjoittaa vektoriin nimen kaikki eri kolmen merkin jonot pakattuina kokonaisluvuiksi
+void name_trigrams(std::string_view name, std::pmr::vector<std::uint32_t>& trigrams)
 {
-    return allBeacons.size();
+    trigrams.clear();
+    for (std::size_t i = 0; i + 3 <= name.size(); ++i) {
+        trigrams.push_back(static_cast<std::uint32_t>(static_cast<unsigned char>(name[i])) << 16 |
+                           static_cast<std::uint32_t>(static_cast<unsigned char>(name[i+1])) << 8 |
+                           static_cast<std::uint32_t>(static_cast<unsigned char>(name[i+2])));
+    }
+    std::sort(trigrams.begin(), trigrams.end());
+    trigrams.erase(std::unique(trigrams.begin(), trigrams.end()), trigrams.end());
 }
 
-void Datastructures::clear_beacons()
+// Rakentaa olion uudestaan vanhan päälle kutsumatta vanhan purkajaa. Käytetään säiliöille, joiden
+// muisti vapautetaan poolista kerralla, jolloin alkioita ei tarvitse purkaa yksitellen.
+template <typename Type, typename... Args>
+void recreate(Type& object, Args&&... args)
 {
-    allBeacons.clear();
-    beaconNames.clear();
-    beaconBrightnesses.clear();
+    new (&object) Type(std::forward<Args>(args)...);
 }
 
-std::vector<BeaconID> Datastructures::all_beacons()
+// Ruudukon solun sivun pituus koordinaatteina
+int const GRID_CELL_SIZE = 32;
+
+// Palauttaa koordinaatin solun indeksin (pyöristys alaspäin myös negatiivisilla koordinaateilla)
+std::int64_t grid_cell(int value)
 {
-    std::vector<BeaconID> beacons = {};
-    for (auto beacon : allBeacons){
-        beacons.push_back(beacon.first);
-    }
-    return beacons;
+    std::int64_t v = value;
+    return v >= 0 ? v / GRID_CELL_SIZE : -((-v + GRID_CELL_SIZE - 1) / GRID_CELL_SIZE);
 }
 
-void Datastructures::update_brightness(BeaconID id)
+// Pakkaa solun koordinaatit unordered_mapin avaimeksi
+std::uint64_t grid_key(std::int64_t cx, std::int64_t cy)
 {
-    Color color = allBeacons.at(id).color;
-    allBeacons.at(id).brightness = 3*color.r+6*color.g+color.b;
+    return static_cast<std::uint64_t>(static_cast<std::uint32_t>(cx)) << 32 |
+           static_cast<std::uint32_t>(cy);
 }
 
-bool Datastructures::add_beacon(BeaconID newId, const std::string& newName, Coord xy, Color newColor)
+// Palauttaa pisteiden etäisyyden neliön
+double squared_distance(Coord c1, Coord c2)
 {
-    if (allBeacons.find(newId) != allBeacons.end()){
-        return false;
-    }
-    Beacon b = Beacon{newId, xy, newName, newColor, nullptr, {}};
-    allBeacons[newId] = b;
-    update_brightness(newId);
-    beaconNames.insert({newName, newId});
-    beaconBrightnesses.insert({allBeacons.at(newId).brightness, newId});
-    return true;
+    double dx = static_cast<double>(c1.x) - c2.x;
+    double dy = static_cast<double>(c1.y) - c2.y;
+    return dx*dx + dy*dy;
 }
 
-std::string Datastructures::get_name(BeaconID id)
+// Tilannevedostiedoston muoto: otsake, majakkatietueet, kuitutietueet ja lopuksi kaikki merkkijonot
+// peräkkäin. Luvut ovat koneen omassa tavujärjestyksessä, ja tarkistussumma lasketaan otsakkeen jälkeisestä
+// datasta. Majakan kohde on kohdemajakan tietueen järjestysnumero tai NO_HANDLE. Versiosta 2 alkaen otsakkeessa
+// on myös viimeisen tilannevedokseen sisältyvän päiväkirjatietueen järjestysnumero.
+char const SNAPSHOT_MAGIC[8] = {'B', 'E', 'A', 'C', 'O', 'N', 'S', '\0'};
+std::uint32_t const SNAPSHOT_VERSION = 2;
+
+struct SnapshotHeader
+{
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t reserved;
+    std::uint64_t beaconCount;
+    std::uint64_t fibreCount;
+    std::uint64_t stringBytes;
+    // Sequence number of the last journal record contained in the snapshot
+    std::uint64_t journalSequence;
+    std::uint64_t checksum;
+};
+
+struct SavedBeacon
+{
+    std::uint64_t idOffset;
+    std::uint64_t nameOffset;
+    std::uint32_t idLength;
+    std::uint32_t nameLength;
+    std::int32_t x, y;
+    std::int32_t r, g, b;
+    std::uint32_t target;
+};
+
+struct SavedFibre
+{
+    std::int32_t x1, y1;
+    std::int32_t x2, y2;
+    std::int32_t cost;
+};
+
+// FNV-1a -tiiviste, jatkaa annetusta tiivisteestä
+std::uint64_t fnv1a(char const* data, std::size_t size, std::uint64_t hash = 0xcbf29ce484222325ull)
 {
-    if (allBeacons.find(id) != allBeacons.end()) {
-        return allBeacons.at(id).name;
+    for (std::size_t i = 0; i < size; ++i) {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 0x100000001b3ull;
     }
-    return NO_NAME;
+    return hash;
 }
 
-Coord Datastructures::get_coordinates(BeaconID id)
+// Tiedoston sisältö luettavana muistina. Unix-järjestelmissä tiedosto muistikartoitetaan, jolloin sitä
+// ei kopioida, muualla se luetaan puskuriin.
+class FileView
 {
-    if (allBeacons.find(id) != allBeacons.end()) {
-        return allBeacons.at(id).coord;
+public:
+    explicit FileView(std::string const& filename)
+    {
+#ifdef __unix__
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+        struct stat info;
+        if (::fstat(fd, &info) == 0 and info.st_size > 0) {
+            void* mapped = ::mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED) {
+                ::madvise(mapped, info.st_size, MADV_SEQUENTIAL);
+                mapping = mapped;
+                bytes = static_cast<char const*>(mapped);
+                length = static_cast<std::size_t>(info.st_size);
+            }
+        }
+        ::close(fd);
+        if (mapping != nullptr) {
+            return;
+        }
+#endif
+        std::ifstream file(filename, std::ios::binary);
+        buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        bytes = buffer.data();
+        length = buffer.size();
     }
-    return NO_COORD;
-}
 
-Color Datastructures::get_color(BeaconID id)
+    ~FileView()
+    {
+#ifdef __unix__
+        if (mapping != nullptr) {
+            ::munmap(mapping, length);
+        }
+#endif
+    }
+
+    FileView(FileView const&) = delete;
+    FileView& operator=(FileView const&) = delete;
+
+    char const* data() const { return bytes; }
+    std::size_t size() const { return length; }
+
+private:
+    void* mapping = nullptr;
+    std::vector<char> buffer;
+    char const* bytes = nullptr;
+    std::size_t length = 0;
+};
+
+// Päiväkirjatiedoston muoto: otsake ja sen perässä tietueet. Tietueen otsakkeen jälkeen tulevat kokonaisluvut
+// ja merkkijonot pituuksineen. Tarkistussumma lasketaan tietueesta järjestysnumerosta alkaen, joten kesken
+// kirjoituksen katkennut viimeinen tietue tunnistetaan.
+char const JOURNAL_MAGIC[8] = {'B', 'E', 'A', 'C', 'O', 'N', 'J', '\0'};
+std::uint32_t const JOURNAL_VERSION = 1;
+
+// Puskurin koko, jonka ylittyessä tietueet kirjoitetaan tiedostoon synkronointitavasta riippumatta
+std::size_t const JOURNAL_BUFFER_LIMIT = 64 * 1024;
+
+struct JournalFileHeader
+{
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t reserved;
+};
+
+struct JournalRecordHeader
+{
+    std::uint32_t payloadLength;
+    std::uint32_t checksum;
+    std::uint64_t sequence;
+    std::uint32_t op;
+    std::uint16_t numberCount;
+    std::uint16_t stringCount;
+};
+
+// Tarkistussumman alku tietueessa (pituus ja summa itse eivät kuulu siihen)
+std::size_t const JOURNAL_CHECKED_OFFSET = offsetof(JournalRecordHeader, sequence);
+
+// Yhden luetun tietueen sisältö, merkkijonot osoittavat tiedoston muistiin
+struct JournalEntry
+{
+    std::uint64_t sequence = 0;
+    JournalOp op = JournalOp::ClearBeacons;
+    std::int32_t numbers[5] = {};
+    std::string_view strings[2];
+};
+
+// Palauttaa operaation kokonaislukujen ja merkkijonojen määrän, {-1, -1} tuntemattomalle operaatiolle
+std::pair<int, int> journal_fields(std::uint32_t op)
 {
-    if (allBeacons.find(id) != allBeacons.end()) {
-        return allBeacons.at(id).color;
+    switch (static_cast<JournalOp>(op)) {
+    case JournalOp::AddBeacon: return {5, 2};
+    case JournalOp::ChangeName: return {0, 2};
+    case JournalOp::ChangeColor: return {3, 1};
+    case JournalOp::AddBeam: return {0, 2};
+    case JournalOp::RemoveBeacon: return {0, 1};
+    case JournalOp::ClearBeacons: return {0, 0};
+    case JournalOp::AddFibre: return {5, 0};
+    case JournalOp::RemoveFibre: return {4, 0};
+    case JournalOp::ClearFibres: return {0, 0};
     }
-    return NO_COLOR;
+    return {-1, -1};
 }
 
+std::uint32_t journal_checksum(char const* data, std::size_t size)
+{
+    std::uint64_t hash = fnv1a(data, size);
+    return static_cast<std::uint32_t>(hash ^ (hash >> 32));
+}
 
-std::vector<BeaconID> Datastructures::beacons_alphabetically()
+// Käy päiväkirjan ehjät tietueet läpi järjestyksessä. visit saa tietueen ja palauttaa false, jos läpikäynti
+// lopetetaan. Palauttaa viimeisen luetun ehjän tietueen lopun tavuina tai 0, jos tiedoston otsake on viallinen.
+template <typename Visit>
+std::size_t read_journal(char const* data, std::size_t size, Visit visit)
 {
-    std::vector<BeaconID> ids = {};
-    if (!beaconNames.empty()) {
-        for (auto name : beaconNames) {
-            ids.push_back(name.second);
+    JournalFileHeader fileHeader = {};
+    if (size < sizeof(fileHeader)) {
+        return 0;
+    }
+    std::memcpy(&fileHeader, data, sizeof(fileHeader));
+    if (!std::equal(std::begin(JOURNAL_MAGIC), std::end(JOURNAL_MAGIC), fileHeader.magic) or
+        fileHeader.version != JOURNAL_VERSION) {
+        return 0;
+    }
+
+    std::size_t position = sizeof(fileHeader);
+    while (size - position >= sizeof(JournalRecordHeader)) {
+        JournalRecordHeader header = {};
+        std::memcpy(&header, data + position, sizeof(header));
+        if (header.payloadLength > size - position - sizeof(header) or
+            journal_checksum(data + position + JOURNAL_CHECKED_OFFSET,
+                             sizeof(header) - JOURNAL_CHECKED_OFFSET + header.payloadLength) != header.checksum) {
+            break;
+        }
+        std::pair<int, int> fields = journal_fields(header.op);
+        if (fields.first != header.numberCount or fields.second != header.stringCount) {
+            break;
+        }
+
+        JournalEntry entry;
+        entry.sequence = header.sequence;
+        entry.op = static_cast<JournalOp>(header.op);
+        char const* payload = data + position + sizeof(header);
+        std::size_t used = header.numberCount * sizeof(std::int32_t);
+        if (used > header.payloadLength) {
+            break;
+        }
+        std::memcpy(entry.numbers, payload, used);
+        bool valid = true;
+        for (int i = 0; i < header.stringCount and valid; ++i) {
+            std::uint32_t length = 0;
+            if (header.payloadLength - used < sizeof(length)) {
+                valid = false;
+                break;
+            }
+            std::memcpy(&length, payload + used, sizeof(length));
+            used += sizeof(length);
+            if (length > header.payloadLength - used) {
+                valid = false;
+                break;
+            }
+            entry.strings[i] = std::string_view(payload + used, length);
+            used += length;
+        }
+        if (!valid or used != header.payloadLength) {
+            break;
+        }
+        position += sizeof(header) + header.payloadLength;
+        if (!visit(entry)) {
+            break;
         }
     }
-    return ids;
+    return position;
 }
 
-std::vector<BeaconID> Datastructures::beacons_brightness_increasing()
+// Suorittaa päiväkirjan tietueen operaation uudestaan julkisten operaatioiden kautta
+void apply_journal_entry(Datastructures& ds, JournalEntry const& entry)
 {
-    std::vector<BeaconID> ids = {};
-    if (!beaconBrightnesses.empty()) {
-        for (auto id : beaconBrightnesses) {
-            ids.push_back(id.second);
-        }
+    auto const& n = entry.numbers;
+    switch (entry.op) {
+    case JournalOp::AddBeacon:
+        ds.add_beacon(BeaconID(entry.strings[0]), std::string(entry.strings[1]), {n[0], n[1]}, {n[2], n[3], n[4]});
+        break;
+    case JournalOp::ChangeName:
+        ds.change_beacon_name(BeaconID(entry.strings[0]), std::string(entry.strings[1]));
+        break;
+    case JournalOp::ChangeColor:
+        ds.change_beacon_color(BeaconID(entry.strings[0]), {n[0], n[1], n[2]});
+        break;
+    case JournalOp::AddBeam:
+        ds.add_lightbeam(BeaconID(entry.strings[0]), BeaconID(entry.strings[1]));
+        break;
+    case JournalOp::RemoveBeacon:
+        ds.remove_beacon(BeaconID(entry.strings[0]));
+        break;
+    case JournalOp::ClearBeacons:
+        ds.clear_beacons();
+        break;
+    case JournalOp::AddFibre:
+        ds.add_fibre({n[0], n[1]}, {n[2], n[3]}, n[4]);
+        break;
+    case JournalOp::RemoveFibre:
+        ds.remove_fibre({n[0], n[1]}, {n[2], n[3]});
+        break;
+    case JournalOp::ClearFibres:
+        ds.clear_fibres();
+        break;
     }
-    return ids;
 }
 
-BeaconID Datastructures::min_brightness()
+// Pakottaa tiedoston ja sen hakemistomerkinnän levylle. Muualla kuin Unix-järjestelmissä ei tehdä mitään.
+bool sync_file(std::string const& filename)
 {
-    BeaconID minId = NO_ID;
-    if (!beaconBrightnesses.empty()) {
-        minId = beaconBrightnesses.begin()->second;
+#ifdef __unix__
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
     }
-    return minId;
+    bool synced = ::fsync(fd) == 0;
+    ::close(fd);
+    std::string::size_type slash = filename.rfind('/');
+    std::string directory = slash == std::string::npos ? "." : filename.substr(0, slash + 1);
+    int dirFd = ::open(directory.c_str(), O_RDONLY);
+    if (dirFd >= 0) {
+        ::fsync(dirFd);
+        ::close(dirFd);
+    }
+    return synced;
+#else
+    return true;
+#endif
 }
 
-BeaconID Datastructures::max_brightness()
+// Kertoo, onko tiedosto olemassa ja luettavissa
+bool file_exists(std::string const& filename)
 {
-    BeaconID maxId = NO_ID;
-    if (!beaconBrightnesses.empty()) {
-        maxId = beaconBrightnesses.rbegin()->second;
-    }
-    return maxId;
+    return std::ifstream(filename, std::ios::binary).good();
 }
 
-std::vector<BeaconID> Datastructures::find_beacons(std::string const& name)
+// Alimman ja ylimmän asetetun bitin indeksi, arvo ei saa olla nolla
+int lowest_bit(std::uint64_t bits)
 {
-    std::vector<BeaconID> beacons = {};
-    for (auto beacon : beaconNames) {
-        if (beacon.first == name) {
-            beacons.push_back(beacon.second);
-        }
+#if defined(__GNUC__)
+    return __builtin_ctzll(bits);
+#else
+    int index = 0;
+    while ((bits & 1) == 0) {
+        bits >>= 1;
+        ++index;
     }
-    std::sort(beacons.begin(), beacons.end());
-    return beacons;
+    return index;
+#endif
 }
 
-bool Datastructures::change_beacon_name(BeaconID id, const std::string& newname)
+int highest_bit(std::uint64_t bits)
 {
-    if (allBeacons.find(id) != allBeacons.end()) {
-        std::string oldName = allBeacons.at(id).name;
-        allBeacons[id].name = newname;
-
-        auto iterpair = beaconNames.equal_range(oldName);
-        auto it = iterpair.first;
-        for (; it != iterpair.second; ++it) {
-            if (it->second == id) {
-                beaconNames.erase(it);
-                break;
-            }
-        }
-        beaconNames.insert({newname,id});
-        return true;
+#if defined(__GNUC__)
+    return 63 - __builtin_clzll(bits);
+#else
+    int index = 63;
+    while ((bits >> index) == 0) {
+        --index;
     }
-    return false;
+    return index;
+#endif
 }
 
-bool Datastructures::change_beacon_color(BeaconID id, Color newcolor)
+// Treapin prioriteetti lasketaan kahvasta sekoittamalla, jolloin se on sama joka ajolla
+std::uint32_t treap_priority(BeaconHandle handle)
 {
-    if (allBeacons.find(id) != allBeacons.end()) {
-        int oldBrightness = allBeacons.at(id).brightness;
-        allBeacons[id].color = newcolor;
-        update_brightness(id);
+    std::uint32_t x = handle * 0x9e3779b1u;
+    x ^= x >> 15;
+    x *= 0x85ebca77u;
+    x ^= x >> 13;
+    return x;
+}
 
-        auto iterpair = beaconBrightnesses.equal_range(oldBrightness);
-        auto it = iterpair.first;
-        for (; it != iterpair.second; ++it) {
-            if (it->second == id) {
-                beaconBrightnesses.erase(it);
-                break;
-            }
-        }
-        beaconBrightnesses.insert({allBeacons.at(id).brightness, id});
-        return true;
-    }
-    return false;
 }
 
-bool Datastructures::add_lightbeam(BeaconID sourceid, BeaconID targetid)
+BrightnessTreap::BrightnessTreap(std::pmr::memory_resource* memory)
+    : nodes(memory)
+{}
+
+std::size_t BrightnessTreap::size() const
 {
-    if (allBeacons.find(sourceid) != allBeacons.end() and allBeacons.find(targetid) != allBeacons.end() and allBeacons.at(sourceid).sending == nullptr) {
-        allBeacons.at(targetid).receiving.push_back(std::make_shared<Beacon>(allBeacons.at(sourceid)));
-        allBeacons.at(sourceid).sending = std::make_shared<Beacon>(allBeacons.at(targetid));
-        return true;
-    }
-    return false;
+    return subtree_size(root);
 }
 
-std::vector<BeaconID> Datastructures::get_lightsources(BeaconID id)
+bool BrightnessTreap::empty() const
 {
-    std::vector<BeaconID> ids;
-    if (allBeacons.find(id) != allBeacons.end()) {
-        std::vector<std::shared_ptr<Beacon>> beams = allBeacons.at(id).receiving;
-        for (auto beam :  beams) {
-            ids.push_back(beam->id);
-        }
-        std::sort(ids.begin(), ids.end());
-        return ids;
-    }
-    return {{NO_ID}};
+    return root == NO_HANDLE;
 }
 
-std::vector<BeaconID> Datastructures::path_recursive(BeaconID id)
+bool BrightnessTreap::less(BeaconHandle h1, BeaconHandle h2) const
 {
-    std::vector<BeaconID> outbeams;
-    if (allBeacons.at(id).sending != nullptr) {
-        outbeams = path_recursive(allBeacons.at(id).sending->id);
-    }
-    outbeams.push_back(id);
-    return outbeams;
+    int b1 = nodes[h1].brightness;
+    int b2 = nodes[h2].brightness;
+    return b1 < b2 or (b1 == b2 and h1 < h2);
 }
 
-std::vector<BeaconID> Datastructures::path_outbeam(BeaconID id)
+std::uint32_t BrightnessTreap::subtree_size(BeaconHandle handle) const
 {
-    if (allBeacons.find(id) == allBeacons.end()) {
-        return {{NO_ID}};
-    }
-    std::vector<BeaconID> beams = path_recursive(id);
-    std::reverse(beams.begin(), beams.end());
-    return beams;
+    return handle == NO_HANDLE ? 0 : nodes[handle].size;
 }
 
-bool Datastructures::remove_beacon(BeaconID id)
+// Kiertää solmun vanhempansa paikalle. Vain näiden kahden solmun alipuiden koot muuttuvat.
+void BrightnessTreap::rotate_up(BeaconHandle handle)
 {
-    if (allBeacons.find(id) == allBeacons.end()) {
-        return false;
-    }
-    auto iterpair = beaconBrightnesses.equal_range(allBeacons.at(id).brightness);
-    auto it = iterpair.first;
-    for (; it != iterpair.second; ++it) {
-        if (it->second == id) {
-            beaconBrightnesses.erase(it);
-            break;
+    Node& node = nodes[handle];
+    BeaconHandle parent = node.parent;
+    Node& parentNode = nodes[parent];
+    BeaconHandle grandparent = parentNode.parent;
+
+    if (parentNode.left == handle) {
+        parentNode.left = node.right;
+        if (node.right != NO_HANDLE) {
+            nodes[node.right].parent = parent;
         }
+        node.right = parent;
     }
-    auto iterpair2 = beaconNames.equal_range(allBeacons.at(id).name);
-    auto it2 = iterpair2.first;
-    for (; it2 != iterpair2.second; ++it2) {
-        if (it2->second == id) {
-            beaconNames.erase(it2);
-            break;
+    else {
+        parentNode.right = node.left;
+        if (node.left != NO_HANDLE) {
+            nodes[node.left].parent = parent;
         }
+        node.left = parent;
     }
-    if (allBeacons.at(id).sending != nullptr) {
-        std::shared_ptr<Beacon> target = allBeacons.at(id).sending;
-        std::shared_ptr<Beacon> source = std::make_shared<Beacon>(allBeacons.at(id));
-        allBeacons.at(target->id).receiving.erase(std::remove(allBeacons.at(target->id).receiving.begin(),
-                                                              allBeacons.at(target->id).receiving.end(), source));
+    parentNode.parent = handle;
+    node.parent = grandparent;
+    if (grandparent == NO_HANDLE) {
+        root = handle;
     }
-    if (!allBeacons.at(id).receiving.empty()) {
-        for (auto beacon : allBeacons.at(id).receiving) {
-            allBeacons.at(beacon->id).sending = nullptr;
-        }
+    else if (nodes[grandparent].left == parent) {
+        nodes[grandparent].left = handle;
     }
-    allBeacons.erase(id);
-    return true;
+    else {
+        nodes[grandparent].right = handle;
+    }
+    parentNode.size = 1 + subtree_size(parentNode.left) + subtree_size(parentNode.right);
+    node.size = 1 + subtree_size(node.left) + subtree_size(node.right);
 }
 
-std::vector<BeaconID> Datastructures::path_inbeam_longest(BeaconID /*id*/)
+// Lisää solmun lehdeksi ja kiertää sitä ylöspäin, kunnes prioriteetit ovat kekojärjestyksessä
+void BrightnessTreap::insert(BeaconHandle handle, int brightness)
 {
-    return {NO_ID};
+    if (handle >= nodes.size()) {
+        nodes.resize(handle + 1);
+    }
+    nodes[handle] = Node{NO_HANDLE, NO_HANDLE, NO_HANDLE, 1, treap_priority(handle), brightness};
+
+    BeaconHandle parent = NO_HANDLE;
+    for (BeaconHandle current = root; current != NO_HANDLE;) {
+        ++nodes[current].size;
+        parent = current;
+        current = less(handle, current) ? nodes[current].left : nodes[current].right;
+    }
+    nodes[handle].parent = parent;
+    if (parent == NO_HANDLE) {
+        root = handle;
+    }
+    else if (less(handle, parent)) {
+        nodes[parent].left = handle;
+    }
+    else {
+        nodes[parent].right = handle;
+    }
+    while (nodes[handle].parent != NO_HANDLE and
+           nodes[handle].priority > nodes[nodes[handle].parent].priority) {
+        rotate_up(handle);
+    }
 }
 
-Color Datastructures::color_recursive(BeaconID id)
+// Rakentaa karteesisen puun järjestetyistä avaimista pinon avulla lineaarisessa ajassa.
+// Pinossa on puun oikea reuna; solmun alipuu on valmis, kun se poistetaan pinosta.
+void BrightnessTreap::build_sorted(std::pmr::vector<std::pair<int, BeaconHandle>> const& keys)
 {
-    Color thisColor = allBeacons.at(id).color;
+    std::pmr::vector<BeaconHandle> spine(std::pmr::new_delete_resource());
+    auto finish = [this](BeaconHandle handle) {
+        Node& node = nodes[handle];
+        node.size = 1 + subtree_size(node.left) + subtree_size(node.right);
+    };
+    for (auto const& [brightness, handle] : keys) {
+        if (handle >= nodes.size()) {
+            nodes.resize(handle + 1);
+        }
+        nodes[handle] = Node{NO_HANDLE, NO_HANDLE, NO_HANDLE, 1, treap_priority(handle), brightness};
 
-    if (allBeacons.at(id).receiving.empty()) {
-        return allBeacons.at(id).color;
+        BeaconHandle lastPopped = NO_HANDLE;
+        while (not spine.empty() and nodes[spine.back()].priority < nodes[handle].priority) {
+            lastPopped = spine.back();
+            spine.pop_back();
+            finish(lastPopped);
+        }
+        nodes[handle].left = lastPopped;
+        if (lastPopped != NO_HANDLE) {
+            nodes[lastPopped].parent = handle;
+        }
+        if (not spine.empty()) {
+            nodes[spine.back()].right = handle;
+            nodes[handle].parent = spine.back();
+        }
+        spine.push_back(handle);
     }
-    for (auto beacon : allBeacons.at(id).receiving) {
-            Color someColor = color_recursive(beacon->id);
-            thisColor.r += someColor.r;
-            thisColor.g += someColor.g;
-            thisColor.b += someColor.b;
+    while (not spine.empty()) {
+        finish(spine.back());
+        spine.pop_back();
+    }
+    if (not keys.empty()) {
+        root = keys.front().second;
+        while (nodes[root].parent != NO_HANDLE) {
+            root = nodes[root].parent;
+        }
     }
-    int divider = static_cast<int>(allBeacons.at(id).receiving.size()+1);
-    int newR = thisColor.r / divider;
-    int newG = thisColor.g / divider;
-    int newB = thisColor.b / divider;
-
-    return {newR, newG, newB};
 }
 
-Color Datastructures::total_color(BeaconID id)
+// Kiertää solmua alaspäin, kunnes sillä on enintään yksi lapsi, ja ohittaa sen sitten
+void BrightnessTreap::erase(BeaconHandle handle)
 {
-    if (allBeacons.find(id) == allBeacons.end()) {
-        return NO_COLOR;
+    while (nodes[handle].left != NO_HANDLE and nodes[handle].right != NO_HANDLE) {
+        BeaconHandle left = nodes[handle].left;
+        BeaconHandle right = nodes[handle].right;
+        rotate_up(nodes[left].priority > nodes[right].priority ? left : right);
     }
-    return color_recursive(id);
+    Node& node = nodes[handle];
+    BeaconHandle child = node.left != NO_HANDLE ? node.left : node.right;
+    BeaconHandle parent = node.parent;
+    if (child != NO_HANDLE) {
+        nodes[child].parent = parent;
+    }
+    if (parent == NO_HANDLE) {
+        root = child;
+    }
+    else if (nodes[parent].left == handle) {
+        nodes[parent].left = child;
+    }
+    else {
+        nodes[parent].right = child;
+    }
+    for (; parent != NO_HANDLE; parent = nodes[parent].parent) {
+        --nodes[parent].size;
+    }
+    node = Node{};
 }
 
-std::pair<Coord, Coord> Datastructures::swapCoords(std::pair<Coord, Coord> point)
+std::size_t BrightnessTreap::order_of_key(int brightness, BeaconHandle handle) const
 {
-    if (operator<(point.second, point.first)) {
-        std::swap(point.first, point.second);
+    std::size_t smaller = 0;
+    BeaconHandle current = root;
+    while (current != NO_HANDLE) {
+        Node const& node = nodes[current];
+        if (node.brightness < brightness or (node.brightness == brightness and current < handle)) {
+            smaller += subtree_size(node.left) + 1;
+            current = node.right;
+        }
+        else {
+            current = node.left;
+        }
     }
-    return point;
+    return smaller;
 }
 
-// Palauttaa kaikki tietorakenteessa olevat kuitujen päätepisteet koordinaattien mukaisessa järjestyksessä
-// ja jokainen päätepiste on mukana vain kerran.
-std::vector<Coord> Datastructures::all_xpoints()
+BeaconHandle BrightnessTreap::find_by_order(std::size_t k) const
 {
-    std::vector<Coord> xpoints = {};
-    for (auto x : allFibres) {
-        if (std::find(xpoints.begin(), xpoints.end(), x.first) == xpoints.end()) {
-            xpoints.push_back(x.first);
+    BeaconHandle current = root;
+    while (current != NO_HANDLE) {
+        std::size_t leftSize = subtree_size(nodes[current].left);
+        if (k < leftSize) {
+            current = nodes[current].left;
+        }
+        else if (k == leftSize) {
+            return current;
+        }
+        else {
+            k -= leftSize + 1;
+            current = nodes[current].right;
         }
     }
-    return xpoints;
+    return NO_HANDLE;
 }
 
-// Lisää tietorakenteeseen uuden valokuidun annettujen pisteiden välille ja annetulla hinnalla.
-// Jos annettujen pisteiden välillä on jo kuitu tai jos molemmat pisteet ovat samat, ei tehdä mitään ja palautetaan false, muuten palautetaan true
-bool Datastructures::add_fibre(Coord xpoint1, Coord xpoint2, Cost cost)
+BeaconHandle BrightnessTreap::first() const
 {
-    std::pair<Coord, Coord> points = swapCoords(std::make_pair(xpoint1, xpoint2));
+    BeaconHandle current = root;
+    while (current != NO_HANDLE and nodes[current].left != NO_HANDLE) {
+        current = nodes[current].left;
+    }
+    return current;
+}
 
-    if (xpoint1 == xpoint2 or fibreCoords.find(points) != fibreCoords.end()) {
-        return false;
+BeaconHandle BrightnessTreap::last() const
+{
+    BeaconHandle current = root;
+    while (current != NO_HANDLE and nodes[current].right != NO_HANDLE) {
+        current = nodes[current].right;
     }
+    return current;
+}
 
-    if (allFibres.find(points.first) == allFibres.end()) {
-        Xpoint f = Xpoint{points.first, {{points.second, cost}}};
-        allFibres[points.first] = f;
+BeaconHandle BrightnessTreap::next(BeaconHandle handle) const
+{
+    if (nodes[handle].right != NO_HANDLE) {
+        handle = nodes[handle].right;
+        while (nodes[handle].left != NO_HANDLE) {
+            handle = nodes[handle].left;
+        }
+        return handle;
     }
-    else {
-        allFibres[points.first].fibres.insert({points.second, cost});
+    BeaconHandle parent = nodes[handle].parent;
+    while (parent != NO_HANDLE and nodes[parent].right == handle) {
+        handle = parent;
+        parent = nodes[parent].parent;
     }
+    return parent;
+}
 
-    if (allFibres.find(points.second) == allFibres.end()) {
-        Xpoint fi = Xpoint{points.second, {{points.first, cost}}};
-        allFibres[points.second] = fi;
+BeaconHandle BrightnessTreap::prev(BeaconHandle handle) const
+{
+    if (nodes[handle].left != NO_HANDLE) {
+        handle = nodes[handle].left;
+        while (nodes[handle].right != NO_HANDLE) {
+            handle = nodes[handle].right;
+        }
+        return handle;
     }
-    else {
-        allFibres[points.second].fibres.insert({points.first, cost});
+    BeaconHandle parent = nodes[handle].parent;
+    while (parent != NO_HANDLE and nodes[parent].left == handle) {
+        handle = parent;
+        parent = nodes[parent].parent;
     }
-
-    fibreCoords[points] = cost;
-    return true;
+    return parent;
 }
 
-// Palauttaa listan koordinaatteja, joihin annetusta koordinaatista menee suoraan kuituja, ja ko. kuidun hinnan.
-// Lista on järjestetty koordinaattien mukaiseen järjestykseen. Jos annetusta pisteestä ei lähde kuituja, palautetaan tyhjä lista.
-std::vector<std::pair<Coord, Cost>> Datastructures::get_fibres_from(Coord xpoint)
-{
-    std::vector<std::pair<Coord, Cost>> coords = {};
+// Ämpärit varataan vasta ensimmäisessä lisäyksessä, jotta tyhjän indeksin rakentaminen ei varaa muistia
+BrightnessBuckets::BrightnessBuckets(std::pmr::memory_resource* memory)
+    : buckets(memory), positions(memory), counts(memory)
+{}
 
-    if (allFibres.find(xpoint) != allFibres.end()) {
+std::size_t BrightnessBuckets::size() const
+{
+    return count;
+}
 
-        std::for_each(allFibres.at(xpoint).fibres.begin(), allFibres.at(xpoint).fibres.end(),
-                      [&](const std::pair<Coord, Cost> &p){coords.push_back(p);});
+bool BrightnessBuckets::empty() const
+{
+    return count == 0;
+}
 
+void BrightnessBuckets::insert(BeaconHandle handle, int brightness)
+{
+    if (buckets.empty()) {
+        buckets.resize(BUCKET_COUNT);
+        counts.resize(BUCKET_COUNT + 1, 0);
     }
-    return coords;
+    if (handle >= positions.size()) {
+        positions.resize(handle + 1);
+    }
+    int bucket = brightness - MIN_BUCKET_BRIGHTNESS;
+    std::pmr::vector<BeaconHandle>& list = buckets[bucket];
+    positions[handle] = Position{bucket, static_cast<std::uint32_t>(list.size())};
+    list.push_back(handle);
+    if (list.size() == 1) {
+        bucketBits[bucket / 64] |= std::uint64_t(1) << (bucket % 64);
+        wordBits |= std::uint64_t(1) << (bucket / 64);
+    }
+    add_count(bucket, 1);
+    ++count;
 }
 
-// Palauttaa listan kaikista kuiduista. Listassa jokainen kuitu ilmoitetaan sen päätepisteiden muodostamana koordinaattiparina niin,
-// että lista on järjestetty ensisijaisesti ensimmäisen koordinaatin mukaan, toissijaisesti toisen.
-std::vector<std::pair<Coord, Coord>> Datastructures::all_fibres()
+// Ämpärin viimeinen majakka siirretään poistettavan paikalle, jolloin poisto on vakioaikainen
+void BrightnessBuckets::erase(BeaconHandle handle)
 {
-    std::vector<std::pair<Coord, Coord>> fibres = {};
-
-    for (auto pair : fibreCoords) {
-        fibres.push_back(pair.first);
+    Position position = positions[handle];
+    std::pmr::vector<BeaconHandle>& list = buckets[position.bucket];
+    BeaconHandle moved = list.back();
+    list[position.index] = moved;
+    positions[moved].index = position.index;
+    list.pop_back();
+    if (list.empty()) {
+        bucketBits[position.bucket / 64] &= ~(std::uint64_t(1) << (position.bucket % 64));
+        if (bucketBits[position.bucket / 64] == 0) {
+            wordBits &= ~(std::uint64_t(1) << (position.bucket / 64));
+        }
     }
-    return fibres;
+    add_count(position.bucket, -1);
+    positions[handle] = Position{};
+    --count;
 }
 
-// Poistaa kuidun annettujen koordinaattien väliltä. Jos koordinaattien välillä ei ollut kuitua,
-// palautetaan false, muuten true.
-bool Datastructures::remove_fibre(Coord xpoint1, Coord xpoint2)
-{    
-    std::pair<Coord, Coord> points = swapCoords(std::make_pair(xpoint1, xpoint2));
+std::size_t BrightnessBuckets::rank(BeaconHandle handle) const
+{
+    Position position = positions[handle];
+    return prefix_count(position.bucket) + position.index;
+}
 
-    if (fibreCoords.find(points) == fibreCoords.end() ) {
-        return false;
+std::size_t BrightnessBuckets::count_below(int brightness) const
+{
+    if (count == 0 or brightness <= MIN_BUCKET_BRIGHTNESS) {
+        return 0;
     }
-
-    fibreCoords.erase(points);
-
-    if (allFibres.find(xpoint1) != allFibres.end()) {
-        allFibres.at(xpoint1).fibres.erase(xpoint2);
-        if (allFibres.at(xpoint1).fibres.empty()) {
-            allFibres.erase(xpoint1);
-        }
+    if (brightness > MAX_BUCKET_BRIGHTNESS) {
+        return count;
     }
+    return prefix_count(brightness - MIN_BUCKET_BRIGHTNESS);
+}
 
-    if (allFibres.find(xpoint2) != allFibres.end()) {
-        allFibres.at(xpoint2).fibres.erase(xpoint1);
-        if (allFibres.at(xpoint2).fibres.empty()) {
-            allFibres.erase(xpoint2);
+// Laskeutuu Fenwick-puussa suurimpaan ämpäriin, jota edeltävissä ämpäreissä on enintään k majakkaa
+BeaconHandle BrightnessBuckets::find_by_order(std::size_t k) const
+{
+    if (k >= count) {
+        return NO_HANDLE;
+    }
+    std::size_t node = 0;
+    for (std::size_t step = std::size_t(1) << 11; step != 0; step >>= 1) {
+        if (node + step <= BUCKET_COUNT and counts[node + step] <= k) {
+            node += step;
+            k -= counts[node];
         }
     }
+    return buckets[node][k];
+}
 
-    return true;
+BeaconHandle BrightnessBuckets::first() const
+{
+    int bucket = next_bucket(0);
+    return bucket < 0 ? NO_HANDLE : buckets[bucket].front();
 }
 
-void Datastructures::clear_fibres()
+BeaconHandle BrightnessBuckets::last() const
 {
-    allFibres.clear();
-    fibreCoords.clear();
+    int bucket = prev_bucket(BUCKET_COUNT - 1);
+    return bucket < 0 ? NO_HANDLE : buckets[bucket].back();
 }
 
-std::vector<Coord> Datastructures::bfsRoute(Coord from, Coord to)
+BeaconHandle BrightnessBuckets::next(BeaconHandle handle) const
 {
-    std::list<std::vector<Coord>> queue;
-    std::vector<Coord> route;
-    route.push_back(from);
-    queue.push_back(route);
+    Position position = positions[handle];
+    if (position.index + 1 < buckets[position.bucket].size()) {
+        return buckets[position.bucket][position.index + 1];
+    }
+    int bucket = next_bucket(position.bucket + 1);
+    return bucket < 0 ? NO_HANDLE : buckets[bucket].front();
+}
 
-    while (!queue.empty()) {
-        route = queue.front();
-        queue.pop_front();
+BeaconHandle BrightnessBuckets::prev(BeaconHandle handle) const
+{
+    Position position = positions[handle];
+    if (position.index > 0) {
+        return buckets[position.bucket][position.index - 1];
+    }
+    int bucket = prev_bucket(position.bucket - 1);
+    return bucket < 0 ? NO_HANDLE : buckets[bucket].back();
+}
+
+void BrightnessBuckets::collect(std::pmr::vector<std::pair<int, BeaconHandle>>& keys) const
+{
+    for (int bucket = next_bucket(0); bucket >= 0; bucket = next_bucket(bucket + 1)) {
+        for (BeaconHandle handle : buckets[bucket]) {
+            keys.emplace_back(bucket + MIN_BUCKET_BRIGHTNESS, handle);
+        }
+    }
+}
+
+// Etsitään ensin sanasta, ja jos siinä ei ole enää bittejä, ylemmän tason bitit kertovat seuraavan ei-tyhjän sanan
+int BrightnessBuckets::next_bucket(int bucket) const
+{
+    if (bucket >= BUCKET_COUNT) {
+        return -1;
+    }
+    int word = bucket / 64;
+    std::uint64_t bits = bucketBits[word] & (~std::uint64_t(0) << (bucket % 64));
+    if (bits != 0) {
+        return word * 64 + lowest_bit(bits);
+    }
+    std::uint64_t words = word + 1 < 64 ? wordBits & (~std::uint64_t(0) << (word + 1)) : 0;
+    if (words == 0) {
+        return -1;
+    }
+    word = lowest_bit(words);
+    return word * 64 + lowest_bit(bucketBits[word]);
+}
+
+int BrightnessBuckets::prev_bucket(int bucket) const
+{
+    if (bucket < 0) {
+        return -1;
+    }
+    int word = bucket / 64;
+    std::uint64_t bits = bucketBits[word] & (~std::uint64_t(0) >> (63 - bucket % 64));
+    if (bits != 0) {
+        return word * 64 + highest_bit(bits);
+    }
+    std::uint64_t words = wordBits & ((std::uint64_t(1) << word) - 1);
+    if (words == 0) {
+        return -1;
+    }
+    word = highest_bit(words);
+    return word * 64 + highest_bit(bucketBits[word]);
+}
+
+std::size_t BrightnessBuckets::prefix_count(int bucket) const
+{
+    std::size_t sum = 0;
+    for (int node = bucket; node > 0; node -= node & -node) {
+        sum += counts[node];
+    }
+    return sum;
+}
+
+void BrightnessBuckets::add_count(int bucket, int delta)
+{
+    for (int node = bucket + 1; node <= BUCKET_COUNT; node += node & -node) {
+        counts[node] += delta;
+    }
+}
+
+BrightnessIndex::BrightnessIndex(std::pmr::memory_resource* memory)
+    : memory(memory), buckets(memory), treap(memory)
+{}
+
+std::size_t BrightnessIndex::size() const
+{
+    return bucketMode ? buckets.size() : treap.size();
+}
+
+bool BrightnessIndex::empty() const
+{
+    return bucketMode ? buckets.empty() : treap.empty();
+}
+
+void BrightnessIndex::insert(BeaconHandle handle, int brightness)
+{
+    if (bucketMode and (brightness < MIN_BUCKET_BRIGHTNESS or brightness > MAX_BUCKET_BRIGHTNESS)) {
+        switch_to_treap();
+    }
+    if (bucketMode) {
+        buckets.insert(handle, brightness);
+    }
+    else {
+        treap.insert(handle, brightness);
+    }
+}
+
+void BrightnessIndex::erase(BeaconHandle handle)
+{
+    if (bucketMode) {
+        buckets.erase(handle);
+        return;
+    }
+    treap.erase(handle);
+    if (treap.empty()) {
+        bucketMode = true;
+    }
+}
+
+// Ämpäreihin lisäys on vakioaikainen, joten järjestäminen tarvitaan vain, kun tyhjä puu rakennetaan kerralla
+void BrightnessIndex::insert_all(std::pmr::vector<std::pair<int, BeaconHandle>>& keys)
+{
+    bool inRange = std::all_of(keys.begin(), keys.end(), [](std::pair<int, BeaconHandle> const& key) {
+        return key.first >= MIN_BUCKET_BRIGHTNESS and key.first <= MAX_BUCKET_BRIGHTNESS;
+    });
+    if (bucketMode and inRange) {
+        for (auto const& key : keys) {
+            buckets.insert(key.second, key.first);
+        }
+        return;
+    }
+    if (empty()) {
+        std::sort(keys.begin(), keys.end());
+        bucketMode = false;
+        treap.build_sorted(keys);
+        return;
+    }
+    for (auto const& key : keys) {
+        insert(key.second, key.first);
+    }
+}
+
+std::size_t BrightnessIndex::rank(BeaconHandle handle, int brightness) const
+{
+    return bucketMode ? buckets.rank(handle) : treap.order_of_key(brightness, handle);
+}
+
+std::size_t BrightnessIndex::count_below(int brightness) const
+{
+    return bucketMode ? buckets.count_below(brightness) : treap.order_of_key(brightness, 0);
+}
+
+BeaconHandle BrightnessIndex::find_by_order(std::size_t k) const
+{
+    return bucketMode ? buckets.find_by_order(k) : treap.find_by_order(k);
+}
+
+BeaconHandle BrightnessIndex::first() const
+{
+    return bucketMode ? buckets.first() : treap.first();
+}
+
+BeaconHandle BrightnessIndex::last() const
+{
+    return bucketMode ? buckets.last() : treap.last();
+}
+
+BeaconHandle BrightnessIndex::next(BeaconHandle handle) const
+{
+    return bucketMode ? buckets.next(handle) : treap.next(handle);
+}
+
+BeaconHandle BrightnessIndex::prev(BeaconHandle handle) const
+{
+    return bucketMode ? buckets.prev(handle) : treap.prev(handle);
+}
+
+bool BrightnessIndex::uses_buckets() const
+{
+    return bucketMode;
+}
+
+// Puu rakennetaan kerralla ämpäreiden järjestyksestä, joka on jo kirkkauden mukainen; saman kirkkauden
+// majakat järjestetään kahvan mukaan. Ämpärit rakennetaan tyhjinä uudestaan.
+void BrightnessIndex::switch_to_treap()
+{
+    std::pmr::vector<std::pair<int, BeaconHandle>> keys(std::pmr::new_delete_resource());
+    keys.reserve(buckets.size());
+    buckets.collect(keys);
+    std::sort(keys.begin(), keys.end());
+    buckets = BrightnessBuckets(memory);
+    bucketMode = false;
+    treap.build_sorted(keys);
+}
+
+BeamLinkCutTree::BeamLinkCutTree(std::pmr::memory_resource* memory)
+    : nodes(memory)
+{}
+
+void BeamLinkCutTree::reset(BeaconHandle handle, int brightness)
+{
+    if (handle >= nodes.size()) {
+        nodes.resize(handle + 1);
+    }
+    nodes[handle] = Node{NO_HANDLE, NO_HANDLE, NO_HANDLE, 1, brightness, handle, handle, brightness};
+}
+
+void BeamLinkCutTree::attach(BeaconHandle child, BeaconHandle parent)
+{
+    nodes[child].parent = parent;
+}
+
+void BeamLinkCutTree::link(BeaconHandle root, BeaconHandle target)
+{
+    // Juurella ei ole edeltäjiä, joten accessin jälkeen se on splay-puussaan yksin vasemmalta
+    access(root);
+    nodes[root].parent = target;
+}
+
+void BeamLinkCutTree::cut(BeaconHandle handle)
+{
+    access(handle);
+    BeaconHandle ancestors = nodes[handle].left;
+    if (ancestors != NO_HANDLE) {
+        nodes[ancestors].parent = NO_HANDLE;
+        nodes[handle].left = NO_HANDLE;
+        pull(handle);
+    }
+}
+
+// Solmu nostetaan ensin splay-puunsa juureksi, jolloin vain sen koostearvo täytyy laskea uudestaan
+void BeamLinkCutTree::set_brightness(BeaconHandle handle, int brightness)
+{
+    splay(handle);
+    nodes[handle].brightness = brightness;
+    pull(handle);
+}
+
+BeaconHandle BeamLinkCutTree::find_root(BeaconHandle handle)
+{
+    access(handle);
+    BeaconHandle root = handle;
+    while (nodes[root].left != NO_HANDLE) {
+        root = nodes[root].left;
+    }
+    splay(root);
+    return root;
+}
+
+std::size_t BeamLinkCutTree::depth(BeaconHandle handle)
+{
+    access(handle);
+    BeaconHandle ancestors = nodes[handle].left;
+    return ancestors == NO_HANDLE ? 0 : nodes[ancestors].size;
+}
+
+BeaconHandle BeamLinkCutTree::path_max(BeaconHandle handle)
+{
+    access(handle);
+    return nodes[handle].best;
+}
+
+BeaconHandle BeamLinkCutTree::path_min(BeaconHandle handle)
+{
+    access(handle);
+    return nodes[handle].worst;
+}
+
+std::int64_t BeamLinkCutTree::path_sum(BeaconHandle handle)
+{
+    access(handle);
+    return nodes[handle].brightnessSum;
+}
+
+bool BeamLinkCutTree::is_splay_root(BeaconHandle handle) const
+{
+    BeaconHandle parent = nodes[handle].parent;
+    return parent == NO_HANDLE or (nodes[parent].left != handle and nodes[parent].right != handle);
+}
+
+// Tasapelissä syvempi (oikealla oleva) majakka voittaa, jolloin kirkkain on lähintä kysyttyä majakkaa
+void BeamLinkCutTree::pull(BeaconHandle handle)
+{
+    Node& node = nodes[handle];
+    node.size = 1;
+    node.best = handle;
+    node.worst = handle;
+    node.brightnessSum = node.brightness;
+    if (node.right != NO_HANDLE) {
+        Node const& right = nodes[node.right];
+        node.size += right.size;
+        node.brightnessSum += right.brightnessSum;
+        if (nodes[right.best].brightness >= node.brightness) {
+            node.best = right.best;
+        }
+        if (nodes[right.worst].brightness <= node.brightness) {
+            node.worst = right.worst;
+        }
+    }
+    if (node.left != NO_HANDLE) {
+        Node const& left = nodes[node.left];
+        node.size += left.size;
+        node.brightnessSum += left.brightnessSum;
+        if (nodes[left.best].brightness > nodes[node.best].brightness) {
+            node.best = left.best;
+        }
+        if (nodes[left.worst].brightness < nodes[node.worst].brightness) {
+            node.worst = left.worst;
+        }
+    }
+}
+
+void BeamLinkCutTree::rotate(BeaconHandle handle)
+{
+    BeaconHandle parent = nodes[handle].parent;
+    BeaconHandle grandparent = nodes[parent].parent;
+    bool parentIsRoot = is_splay_root(parent);
+    if (nodes[parent].left == handle) {
+        nodes[parent].left = nodes[handle].right;
+        if (nodes[handle].right != NO_HANDLE) {
+            nodes[nodes[handle].right].parent = parent;
+        }
+        nodes[handle].right = parent;
+    }
+    else {
+        nodes[parent].right = nodes[handle].left;
+        if (nodes[handle].left != NO_HANDLE) {
+            nodes[nodes[handle].left].parent = parent;
+        }
+        nodes[handle].left = parent;
+    }
+    // Splay-puun juuren vanhempi on polun vanhempi, joka siirtyy uudelle juurelle
+    if (!parentIsRoot) {
+        if (nodes[grandparent].left == parent) {
+            nodes[grandparent].left = handle;
+        }
+        else {
+            nodes[grandparent].right = handle;
+        }
+    }
+    nodes[handle].parent = grandparent;
+    nodes[parent].parent = handle;
+    pull(parent);
+    pull(handle);
+}
+
+void BeamLinkCutTree::splay(BeaconHandle handle)
+{
+    while (!is_splay_root(handle)) {
+        BeaconHandle parent = nodes[handle].parent;
+        if (!is_splay_root(parent)) {
+            BeaconHandle grandparent = nodes[parent].parent;
+            bool zigZig = (nodes[grandparent].left == parent) == (nodes[parent].left == handle);
+            rotate(zigZig ? parent : handle);
+        }
+        rotate(handle);
+    }
+}
+
+// Jokaisella kierroksella solmun splay-puu liitetään polun vanhemman oikeaksi lapseksi, jolloin
+// vanhemman aiempi oikea osa (syvempi polku) jää oman splay-puunsa juureksi
+void BeamLinkCutTree::access(BeaconHandle handle)
+{
+    splay(handle);
+    nodes[handle].right = NO_HANDLE;
+    pull(handle);
+    while (nodes[handle].parent != NO_HANDLE) {
+        BeaconHandle pathParent = nodes[handle].parent;
+        splay(pathParent);
+        nodes[pathParent].right = handle;
+        pull(pathParent);
+        splay(handle);
+    }
+}
+
+BeamEulerTour::BeamEulerTour(std::pmr::memory_resource* memory)
+    : nodes(memory)
+{}
+
+// Majakan avaava merkki on ennen sulkevaa, joten majakan oma kierros on avaava merkki, jonka oikea lapsi on sulkeva
+void BeamEulerTour::reset(BeaconHandle handle, Color color)
+{
+    std::uint32_t open = 2 * handle;
+    if (open + 1 >= nodes.size()) {
+        nodes.resize(open + 2);
+    }
+    nodes[open] = Node();
+    nodes[open].color = color;
+    nodes[open + 1] = Node();
+    nodes[open].right = open + 1;
+    nodes[open + 1].parent = open;
+    pull(open + 1);
+    pull(open);
+}
+
+void BeamEulerTour::build(std::pmr::vector<std::uint32_t> const& tokens)
+{
+    build_range(tokens, 0, tokens.size(), NO_HANDLE);
+}
+
+// Keskimmäinen merkki on juuri, jolloin puun syvyys on logaritminen
+std::uint32_t BeamEulerTour::build_range(std::pmr::vector<std::uint32_t> const& tokens, std::size_t begin,
+                                         std::size_t end, std::uint32_t parent)
+{
+    if (begin == end) {
+        return NO_HANDLE;
+    }
+    std::size_t middle = begin + (end - begin) / 2;
+    std::uint32_t token = tokens[middle];
+    nodes[token].parent = parent;
+    nodes[token].left = build_range(tokens, begin, middle, token);
+    nodes[token].right = build_range(tokens, middle + 1, end, token);
+    pull(token);
+    return token;
+}
+
+// Kohteen avaavan merkin jälkeinen osa irrotetaan, juuren kierros liitetään sen paikalle ja osa takaisin perään
+void BeamEulerTour::link(BeaconHandle root, BeaconHandle target)
+{
+    std::uint32_t open = 2 * target;
+    splay(open);
+    std::uint32_t after = nodes[open].right;
+    if (after != NO_HANDLE) {
+        nodes[after].parent = NO_HANDLE;
+    }
+    splay(2 * root);
+    nodes[open].right = 2 * root;
+    nodes[2 * root].parent = open;
+    pull(open);
+    join(open, after);
+}
+
+// Majakan merkkien väli irrotetaan, ja sitä edeltävä ja seuraava osa yhdistetään
+void BeamEulerTour::cut(BeaconHandle handle)
+{
+    std::uint32_t open = 2 * handle;
+    std::uint32_t close = open + 1;
+    splay(open);
+    std::uint32_t before = nodes[open].left;
+    if (before != NO_HANDLE) {
+        nodes[before].parent = NO_HANDLE;
+        nodes[open].left = NO_HANDLE;
+        pull(open);
+    }
+    splay(close);
+    std::uint32_t after = nodes[close].right;
+    if (after != NO_HANDLE) {
+        nodes[after].parent = NO_HANDLE;
+        nodes[close].right = NO_HANDLE;
+        pull(close);
+    }
+    join(before, after);
+}
+
+void BeamEulerTour::set_color(BeaconHandle handle, Color color)
+{
+    splay(2 * handle);
+    nodes[2 * handle].color = color;
+    pull(2 * handle);
+}
+
+// Merkkien sijainti on vasemman alipuun merkkien määrä, kun merkki on splay-puun juuressa
+bool BeamEulerTour::is_inside(BeaconHandle handle, BeaconHandle ancestor)
+{
+    std::uint32_t open = 2 * handle;
+    splay(open);
+    auto position = [this](std::uint32_t token) {
+        return nodes[token].left == NO_HANDLE ? 0 : nodes[nodes[token].left].tokens;
+    };
+    std::uint32_t handlePosition = position(open);
+    if (root_of(2 * ancestor + 1) != open) {
+        return false;
+    }
+    std::uint32_t closePosition = position(2 * ancestor + 1);
+    splay(2 * ancestor);
+    return position(2 * ancestor) < handlePosition and handlePosition < closePosition;
+}
+
+// Summat ennen sulkevaa merkkiä miinus summat ennen avaavaa merkkiä
+BeamEulerTour::Totals BeamEulerTour::inbeam_totals(BeaconHandle handle)
+{
+    std::uint32_t open = 2 * handle;
+    splay(open);
+    Totals before;
+    if (nodes[open].left != NO_HANDLE) {
+        before = nodes[nodes[open].left].totals;
+    }
+    splay(open + 1);
+    Totals totals = nodes[nodes[open + 1].left].totals;
+    totals.beacons -= before.beacons;
+    totals.r -= before.r;
+    totals.g -= before.g;
+    totals.b -= before.b;
+    return totals;
+}
+
+// Vain avaava merkki lasketaan majakaksi, sulkevan merkin väri on nolla
+void BeamEulerTour::pull(std::uint32_t token)
+{
+    Node& node = nodes[token];
+    node.tokens = 1;
+    node.totals = {token % 2 == 0 ? std::size_t(1) : std::size_t(0), node.color.r, node.color.g, node.color.b};
+    for (std::uint32_t child : {node.left, node.right}) {
+        if (child != NO_HANDLE) {
+            Node const& other = nodes[child];
+            node.tokens += other.tokens;
+            node.totals.beacons += other.totals.beacons;
+            node.totals.r += other.totals.r;
+            node.totals.g += other.totals.g;
+            node.totals.b += other.totals.b;
+        }
+    }
+}
+
+void BeamEulerTour::rotate(std::uint32_t token)
+{
+    std::uint32_t parent = nodes[token].parent;
+    std::uint32_t grandparent = nodes[parent].parent;
+    if (nodes[parent].left == token) {
+        nodes[parent].left = nodes[token].right;
+        if (nodes[token].right != NO_HANDLE) {
+            nodes[nodes[token].right].parent = parent;
+        }
+        nodes[token].right = parent;
+    }
+    else {
+        nodes[parent].right = nodes[token].left;
+        if (nodes[token].left != NO_HANDLE) {
+            nodes[nodes[token].left].parent = parent;
+        }
+        nodes[token].left = parent;
+    }
+    if (grandparent != NO_HANDLE) {
+        if (nodes[grandparent].left == parent) {
+            nodes[grandparent].left = token;
+        }
+        else {
+            nodes[grandparent].right = token;
+        }
+    }
+    nodes[token].parent = grandparent;
+    nodes[parent].parent = token;
+    pull(parent);
+    pull(token);
+}
+
+void BeamEulerTour::splay(std::uint32_t token)
+{
+    while (nodes[token].parent != NO_HANDLE) {
+        std::uint32_t parent = nodes[token].parent;
+        std::uint32_t grandparent = nodes[parent].parent;
+        if (grandparent != NO_HANDLE) {
+            bool zigZig = (nodes[grandparent].left == parent) == (nodes[parent].left == token);
+            rotate(zigZig ? parent : token);
+        }
+        rotate(token);
+    }
+}
+
+// Nousu juureen maksetaan saman pituisella splay-operaatiolla
+std::uint32_t BeamEulerTour::root_of(std::uint32_t token)
+{
+    std::uint32_t root = token;
+    while (nodes[root].parent != NO_HANDLE) {
+        root = nodes[root].parent;
+    }
+    splay(token);
+    return root;
+}
+
+std::uint32_t BeamEulerTour::join(std::uint32_t first, std::uint32_t second)
+{
+    if (first == NO_HANDLE) {
+        return second;
+    }
+    if (second == NO_HANDLE) {
+        return first;
+    }
+    std::uint32_t last = first;
+    while (nodes[last].right != NO_HANDLE) {
+        last = nodes[last].right;
+    }
+    splay(last);
+    nodes[last].right = second;
+    nodes[second].parent = last;
+    pull(last);
+    return last;
+}
+
+CountingResource::CountingResource(std::pmr::memory_resource* upstream)
+    : upstream(upstream)
+{}
+
+AllocationStats CountingResource::stats() const
+{
+    return counters;
+}
+
+void CountingResource::reset_in_use()
+{
+    counters.bytesInUse = 0;
+}
+
+void* CountingResource::do_allocate(std::size_t bytes, std::size_t alignment)
+{
+    void* p = upstream->allocate(bytes, alignment);
+    ++counters.allocations;
+    counters.bytesInUse += bytes;
+    return p;
+}
+
+void CountingResource::do_deallocate(void* p, std::size_t bytes, std::size_t alignment)
+{
+    upstream->deallocate(p, bytes, alignment);
+    ++counters.deallocations;
+    counters.bytesInUse -= bytes;
+}
+
+bool CountingResource::do_is_equal(std::pmr::memory_resource const& other) const noexcept
+{
+    return this == &other;
+}
+
+Journal::~Journal()
+{
+    close();
+}
+
+bool Journal::open(std::string const& filename, JournalSync sync, std::size_t groupSize, bool truncate)
+{
+    close();
+    file = std::fopen(filename.c_str(), truncate ? "wb" : "ab");
+    if (file == nullptr) {
+        return false;
+    }
+    path = filename;
+    policy = sync;
+    this->groupSize = std::max<std::size_t>(groupSize, 1);
+    pending = 0;
+    writeFailed = false;
+    buffer.clear();
+    buffer.reserve(JOURNAL_BUFFER_LIMIT + 4096);
+    if (truncate) {
+        JournalFileHeader header = {};
+        std::copy(std::begin(JOURNAL_MAGIC), std::end(JOURNAL_MAGIC), header.magic);
+        header.version = JOURNAL_VERSION;
+        buffer.append(reinterpret_cast<char const*>(&header), sizeof(header));
+        if (!flush(true)) {
+            close();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Journal::is_open() const
+{
+    return file != nullptr;
+}
+
+// Ryhmän kaikki tietueet kirjoitetaan yhdellä kutsulla ja synkronoidaan yhdellä fsyncillä
+bool Journal::flush(bool durable)
+{
+    if (file == nullptr) {
+        return !writeFailed;
+    }
+    if (!buffer.empty() and !writeFailed) {
+        if (std::fwrite(buffer.data(), 1, buffer.size(), file) != buffer.size() or std::fflush(file) != 0) {
+            writeFailed = true;
+        }
+    }
+    buffer.clear();
+    pending = 0;
+#ifdef __unix__
+    if (durable and !writeFailed and ::fsync(::fileno(file)) != 0) {
+        writeFailed = true;
+    }
+#else
+    (void)durable;
+#endif
+    return !writeFailed;
+}
+
+void Journal::close()
+{
+    if (file == nullptr) {
+        return;
+    }
+    flush(true);
+    std::fclose(file);
+    file = nullptr;
+}
+
+bool Journal::restart()
+{
+    if (file == nullptr) {
+        return false;
+    }
+    std::string filename = path;
+    return open(filename, policy, groupSize, true);
+}
+
+std::uint64_t Journal::last_sequence() const
+{
+    return lastSequence;
+}
+
+void Journal::set_last_sequence(std::uint64_t sequence)
+{
+    lastSequence = sequence;
+}
+
+// Tietue koodataan suoraan puskurin loppuun, ja tiedostoon kirjoitetaan vasta ryhmän täyttyessä
+void Journal::record(JournalOp op, std::initializer_list<std::int32_t> numbers,
+                     std::initializer_list<std::string_view> strings)
+{
+    std::size_t start = buffer.size();
+    buffer.resize(start + sizeof(JournalRecordHeader));
+    buffer.append(reinterpret_cast<char const*>(numbers.begin()), numbers.size() * sizeof(std::int32_t));
+    for (std::string_view string : strings) {
+        std::uint32_t length = static_cast<std::uint32_t>(string.size());
+        buffer.append(reinterpret_cast<char const*>(&length), sizeof(length));
+        buffer.append(string.data(), string.size());
+    }
+
+    JournalRecordHeader header = {};
+    header.payloadLength = static_cast<std::uint32_t>(buffer.size() - start - sizeof(header));
+    header.sequence = ++lastSequence;
+    header.op = static_cast<std::uint32_t>(op);
+    header.numberCount = static_cast<std::uint16_t>(numbers.size());
+    header.stringCount = static_cast<std::uint16_t>(strings.size());
+    std::memcpy(&buffer[start], &header, sizeof(header));
+    header.checksum = journal_checksum(buffer.data() + start + JOURNAL_CHECKED_OFFSET,
+                                       buffer.size() - start - JOURNAL_CHECKED_OFFSET);
+    std::memcpy(&buffer[start + offsetof(JournalRecordHeader, checksum)], &header.checksum, sizeof(header.checksum));
+
+    ++pending;
+    if (policy == JournalSync::Always or (policy == JournalSync::Group and pending >= groupSize)) {
+        flush(true);
+    }
+    else if (buffer.size() >= JOURNAL_BUFFER_LIMIT) {
+        flush(policy != JournalSync::None);
+    }
+}
+
+BeaconColumns::BeaconColumns(std::pmr::memory_resource* memory)
+    : ids(memory), coords(memory), names(memory), colors(memory), brightnesses(memory), sending(memory),
+      receiving(memory), receivingPos(memory), gridPos(memory), totalColors(memory), receivedSums(memory),
+      inbeamHeights(memory), longestSources(memory), longestCounts(memory), handles(memory)
+{}
+
+Datastructures::Datastructures()
+{}
+
+Datastructures::~Datastructures()
+{}
+
+int Datastructures::beacon_count()
+{
+    return beaconHandles.size();
+}
+
+// Säiliöitä ei tyhjennetä alkio kerrallaan, vaan niiden tilalle rakennetaan tyhjät säiliöt ja
+// kaikki vanha muisti (myös internoidut id:t) vapautetaan poolista kerralla.
+void Datastructures::clear_beacons()
+{
+    recreate(beaconHandles, &beaconMemory);
+    recreate(beaconSlots, &beaconMemory);
+    recreate(freeSlots, &beaconMemory);
+    recreate(beacons, &beaconMemory);
+    recreate(beaconNames, NameOrder{this}, &beaconMemory);
+    recreate(nameTrigrams, &beaconMemory);
+    recreate(trigramScratch, &beaconMemory);
+    recreate(beaconBrightnesses, &beaconMemory);
+    recreate(gridCells, &beaconMemory);
+    recreate(traversalStack, &beaconMemory);
+    recreate(beamTree, &beaconMemory);
+    recreate(eulerTour, &beaconMemory);
+    eulerTourUsed = false;
+    recreate(liftValid, &beaconMemory);
+    recreate(liftDepths, &beaconMemory);
+    recreate(liftTable, &beaconMemory);
+    recreate(liftStack, &beaconMemory);
+    liftIndexUsed = false;
+    liftLevels = 0;
+    staleTrigrams = 0;
+    totalTrigrams = 0;
+    beaconPool.release();
+    beaconMemory.reset_in_use();
+    currentVersion.beacons = {};
+    ++currentVersion.versionNumber;
+    if (journal.is_open()) {
+        journal.record(JournalOp::ClearBeacons, {}, {});
+    }
+}
+
+std::vector<BeaconID> Datastructures::all_beacons()
+{
+    auto view = all_beacons_view();
+    return std::vector<BeaconID>(view.begin(), view.end());
+}
+
+AllocationStats Datastructures::beacon_allocation_stats()
+{
+    return beaconMemory.stats();
+}
+
+AllocationStats Datastructures::fibre_allocation_stats()
+{
+    return fibreMemory.stats();
+}
+
+BeaconHandle Datastructures::find_handle(BeaconID const& id) const
+{
+    auto it = beaconHandles.find(id);
+    if (it == beaconHandles.end()) {
+        return NO_HANDLE;
+    }
+    return it->second;
+}
+
+std::uint32_t Datastructures::dense_index(BeaconHandle handle) const
+{
+    return beaconSlots[handle].dense;
+}
+
+std::string_view Datastructures::intern_id(std::string_view id)
+{
+    if (id.empty()) {
+        return {};
+    }
+    char* chars = static_cast<char*>(beaconMemory.allocate(id.size(), 1));
+    std::memcpy(chars, id.data(), id.size());
+    return std::string_view(chars, id.size());
+}
+
+template <typename Visit>
+void Datastructures::walk_chain(BeaconHandle handle, std::pmr::vector<BeaconHandle> BeaconColumns::* links, Visit visit)
+{
+    while (handle != NO_HANDLE) {
+        std::uint32_t d = dense_index(handle);
+        if (!visit(d)) {
+            break;
+        }
+        handle = (beacons.*links)[d];
+    }
+}
+
+template <typename Visit>
+void Datastructures::walk_inbeam_postorder(BeaconHandle root, Visit visit)
+{
+    walk_inbeam_postorder(root, traversalStack, visit);
+}
+
+template <typename Visit>
+void Datastructures::walk_inbeam_postorder(BeaconHandle root,
+                                           std::pmr::vector<std::pair<BeaconHandle, std::uint32_t>>& stack,
+                                           Visit visit) const
+{
+    stack.clear();
+    stack.push_back({root, 0});
+    while (!stack.empty()) {
+        auto& top = stack.back();
+        std::uint32_t d = dense_index(top.first);
+        if (top.second < beacons.receiving[d].size()) {
+            BeaconHandle source = beacons.receiving[d][top.second++];
+            stack.push_back({source, 0});
+        }
+        else {
+            stack.pop_back();
+            visit(d);
+        }
+    }
+}
+
+void Datastructures::update_brightness(BeaconHandle handle)
+{
+    std::uint32_t d = dense_index(handle);
+    Color color = beacons.colors[d];
+    beacons.brightnesses[d] = 3*color.r+6*color.g+color.b;
+}
+
+BeaconHandle Datastructures::append_beacon(std::string_view id, std::string_view name, Coord xy, Color color)
+{
+    BeaconHandle handle = NO_HANDLE;
+    if (!freeSlots.empty()) {
+        handle = freeSlots.back();
+        freeSlots.pop_back();
+    }
+    else {
+        handle = static_cast<BeaconHandle>(beaconSlots.size());
+        beaconSlots.push_back(BeaconSlot{});
+    }
+    beaconSlots[handle].dense = static_cast<std::uint32_t>(beacons.ids.size());
+
+    std::string_view internedId = intern_id(id);
+    beacons.ids.push_back(internedId);
+    beacons.coords.push_back(xy);
+    beacons.names.emplace_back(name);
+    beacons.colors.push_back(color);
+    beacons.brightnesses.push_back(0);
+    beacons.sending.push_back(NO_HANDLE);
+    beacons.receiving.emplace_back();
+    beacons.receivingPos.push_back(0);
+    beacons.gridPos.push_back(0);
+    beacons.totalColors.push_back(color);
+    beacons.receivedSums.push_back(Color{0, 0, 0});
+    beacons.inbeamHeights.push_back(1);
+    beacons.longestSources.push_back(NO_HANDLE);
+    beacons.longestCounts.push_back(0);
+    beacons.handles.push_back(handle);
+
+    beaconHandles.insert({internedId, handle});
+    update_brightness(handle);
+    add_to_grid(handle);
+    beamTree.reset(handle, beacons.brightnesses.back());
+    if (eulerTourUsed) {
+        eulerTour.reset(handle, color);
+    }
+    update_snapshot_beacon(beaconSlots[handle].dense);
+    if (journal.is_open()) {
+        journal.record(JournalOp::AddBeacon, {xy.x, xy.y, color.r, color.g, color.b}, {id, name});
+    }
+    return handle;
+}
+
+void Datastructures::update_snapshot_beacon(std::uint32_t d)
+{
+    if (!snapshotsEnabled) {
+        return;
+    }
+    BeaconHandle target = beacons.sending[d];
+    BeaconRecord record = {std::string(beacons.names[d]), beacons.coords[d], beacons.colors[d],
+                           target == NO_HANDLE ? NO_ID : BeaconID(beacons.ids[dense_index(target)])};
+    currentVersion.beacons = currentVersion.beacons.insert(BeaconID(beacons.ids[d]), record);
+    ++currentVersion.versionNumber;
+}
+
+//Kytkee versioinnin päälle tai pois. Päälle kytkettäessä nykyinen tila kopioidaan pysyviin puihin,
+//minkä jälkeen jokainen muutos tekee puihin uuden version jakaen muuttumattomat solmut vanhojen kanssa.
+void Datastructures::enable_snapshots(bool enabled)
+{
+    snapshotsEnabled = enabled;
+    std::uint64_t version = currentVersion.versionNumber + 1;
+    currentVersion = DataSnapshot{};
+    currentVersion.versionNumber = version;
+    if (!enabled) {
+        return;
+    }
+    for (std::uint32_t d = 0; d < beacons.ids.size(); ++d) {
+        update_snapshot_beacon(d);
+    }
+    for (auto const& fibre : fibreCoords) {
+        currentVersion.fibres = currentVersion.fibres.insert(fibre.first, fibre.second);
+        currentVersion.fibres = currentVersion.fibres.insert({fibre.first.second, fibre.first.first}, fibre.second);
+    }
+}
+
+//Palauttaa nykyisen version. Versio ei muutu, vaikka tietorakennetta muutetaan, ja sen muisti vapautuu,
+//kun viimeinenkin sitä käyttävä lukija luopuu siitä. Jos versiointi ei ole päällä, versio on tyhjä.
+std::shared_ptr<DataSnapshot const> Datastructures::snapshot()
+{
+    return std::make_shared<DataSnapshot const>(currentVersion);
+}
+
+void Datastructures::add_to_grid(BeaconHandle handle)
+{
+    std::uint32_t d = dense_index(handle);
+    Coord xy = beacons.coords[d];
+    auto& cell = gridCells[grid_key(grid_cell(xy.x), grid_cell(xy.y))];
+    beacons.gridPos[d] = static_cast<std::uint32_t>(cell.size());
+    cell.push_back(handle);
+}
+
+void Datastructures::remove_from_grid(std::uint32_t d)
+{
+    Coord xy = beacons.coords[d];
+    auto it = gridCells.find(grid_key(grid_cell(xy.x), grid_cell(xy.y)));
+    auto& cell = it->second;
+    std::uint32_t pos = beacons.gridPos[d];
+    cell[pos] = cell.back();
+    beacons.gridPos[dense_index(cell[pos])] = pos;
+    cell.pop_back();
+    if (cell.empty()) {
+        gridCells.erase(it);
+    }
+}
+
+bool Datastructures::add_beacon(BeaconID newId, const std::string& newName, Coord xy, Color newColor)
+{
+    if (beaconHandles.find(newId) != beaconHandles.end()){
+        return false;
+    }
+    BeaconHandle handle = append_beacon(newId, newName, xy, newColor);
+    beaconNames.insert(handle);
+    add_name_trigrams(handle, newName);
+    beaconBrightnesses.insert(handle, beacons.brightnesses.back());
+    return true;
+}
+
+//Lisää kaikki annetut majakat kerralla. Majakat, joiden id on jo käytössä, ohitetaan. Palauttaa lisättyjen määrän.
+//Majakat lisätään ensin sarakkeisiin, minkä jälkeen uudet kahvat järjestetään kerran ja lisätään indekseihin
+//järjestyksessä, jolloin setin lisäys vihjeen kanssa on vakioaikainen.
+int Datastructures::add_beacons(std::vector<BeaconSpec> const& specs)
+{
+    reserve_beacons(beacons.ids.size() + specs.size());
+
+    // Apuvektorit tarvitaan vain lisäyksen ajan, joten ne varataan paikallisesta areenasta
+    std::pmr::monotonic_buffer_resource scratch(&beaconMemory);
+    std::pmr::vector<BeaconHandle> added(&scratch);
+    added.reserve(specs.size());
+    for (auto const& spec : specs) {
+        if (beaconHandles.find(spec.id) == beaconHandles.end()) {
+            added.push_back(append_beacon(spec.id, spec.name, spec.xy, spec.color));
+            add_name_trigrams(added.back(), spec.name);
+        }
+    }
+    index_new_beacons(added);
+    return static_cast<int>(added.size());
+}
+
+void Datastructures::reserve_beacons(std::size_t newSize)
+{
+    beaconHandles.reserve(newSize);
+    beacons.ids.reserve(newSize);
+    beacons.coords.reserve(newSize);
+    beacons.names.reserve(newSize);
+    beacons.colors.reserve(newSize);
+    beacons.brightnesses.reserve(newSize);
+    beacons.sending.reserve(newSize);
+    beacons.receiving.reserve(newSize);
+    beacons.receivingPos.reserve(newSize);
+    beacons.gridPos.reserve(newSize);
+    beacons.totalColors.reserve(newSize);
+    beacons.receivedSums.reserve(newSize);
+    beacons.inbeamHeights.reserve(newSize);
+    beacons.longestSources.reserve(newSize);
+    beacons.longestCounts.reserve(newSize);
+    beacons.handles.reserve(newSize);
+}
+
+// Uudet majakat lisätään nimi-indeksiin nimen mukaan järjestettyinä, jolloin setin lisäys vihjeen kanssa
+// on vakioaikainen. Järjestää added-vektorin uudelleen.
+void Datastructures::index_new_beacons(std::pmr::vector<BeaconHandle>& added)
+{
+    // Uudet majakat ovat sarakkeiden lopussa, joten järjestetään suoraan sarakeindeksit nimen ja id:n mukaan
+    std::pmr::monotonic_buffer_resource scratch(&beaconMemory);
+    std::pmr::vector<std::uint32_t> order(&scratch);
+    order.reserve(added.size());
+    for (auto handle : added) {
+        order.push_back(dense_index(handle));
+    }
+    std::sort(order.begin(), order.end(), [this](std::uint32_t d1, std::uint32_t d2) {
+        int compared = beacons.names[d1].compare(beacons.names[d2]);
+        return compared < 0 or (compared == 0 and beacons.ids[d1] < beacons.ids[d2]);
+    });
+    for (std::size_t i = 0; i < order.size(); ++i) {
+        added[i] = beacons.handles[order[i]];
+    }
+    auto hint = beaconNames.end();
+    for (auto handle : added) {
+        hint = std::next(beaconNames.insert(hint, handle));
+    }
+
+    std::pmr::vector<std::pair<int, BeaconHandle>> keys(&scratch);
+    keys.reserve(added.size());
+    for (auto handle : added) {
+        keys.emplace_back(beacons.brightnesses[dense_index(handle)], handle);
+    }
+    beaconBrightnesses.insert_all(keys);
+}
+
+std::string Datastructures::get_name(BeaconID id)
+{
+    BeaconHandle handle = find_handle(id);
+    if (handle != NO_HANDLE) {
+        return std::string(beacons.names[dense_index(handle)]);
+    }
+    return NO_NAME;
+}
+
+Coord Datastructures::get_coordinates(BeaconID id)
+{
+    BeaconHandle handle = find_handle(id);
+    if (handle != NO_HANDLE) {
+        return beacons.coords[dense_index(handle)];
+    }
+    return NO_COORD;
+}
+
+Color Datastructures::get_color(BeaconID id)
+{
+    BeaconHandle handle = find_handle(id);
+    if (handle != NO_HANDLE) {
+        return beacons.colors[dense_index(handle)];
+    }
+    return NO_COLOR;
+}
+
+
+std::vector<BeaconID> Datastructures::beacons_alphabetically()
+{
+    auto view = beacons_alphabetically_view();
+    std::vector<BeaconID> ids = {};
+    ids.reserve(view.size());
+    for (auto id : view) {
+        ids.emplace_back(id);
+    }
+    return ids;
+}
+
+std::vector<BeaconID> Datastructures::beacons_brightness_increasing()
+{
+    auto view = beacons_brightness_increasing_view();
+    std::vector<BeaconID> ids = {};
+    ids.reserve(view.size());
+    for (auto id : view) {
+        ids.emplace_back(id);
+    }
+    return ids;
+}
+
+template <typename Visit>
+void Datastructures::visit_rect(Coord min, Coord max, Visit visit)
+{
+    if (min.x > max.x or min.y > max.y) {
+        return;
+    }
+    auto inside = [&](std::uint32_t d) {
+        Coord xy = beacons.coords[d];
+        return min.x <= xy.x and xy.x <= max.x and min.y <= xy.y and xy.y <= max.y;
+    };
+    auto visit_cell = [&](std::pmr::vector<BeaconHandle> const& cell) {
+        for (auto handle : cell) {
+            std::uint32_t d = dense_index(handle);
+            if (inside(d)) {
+                visit(d);
+            }
+        }
+    };
+
+    std::int64_t cx1 = grid_cell(min.x);
+    std::int64_t cx2 = grid_cell(max.x);
+    std::int64_t cy1 = grid_cell(min.y);
+    std::int64_t cy2 = grid_cell(max.y);
+    // Suurelle suorakulmiolle on nopeampaa käydä läpi ei-tyhjät solut kuin suorakulmion kaikki solut
+    if (static_cast<double>(cx2 - cx1 + 1) * static_cast<double>(cy2 - cy1 + 1) > gridCells.size()) {
+        for (auto const& cell : gridCells) {
+            visit_cell(cell.second);
+        }
+        return;
+    }
+    for (std::int64_t cy = cy1; cy <= cy2; ++cy) {
+        for (std::int64_t cx = cx1; cx <= cx2; ++cx) {
+            auto it = gridCells.find(grid_key(cx, cy));
+            if (it != gridCells.end()) {
+                visit_cell(it->second);
+            }
+        }
+    }
+}
+
+//Palauttaa nousevan ID:n mukaisessa järjestyksessä majakat, jotka ovat annetussa suorakulmiossa reunat mukaan lukien.
+std::vector<BeaconID> Datastructures::beacons_in_rect(Coord min, Coord max)
+{
+    std::vector<BeaconID> ids = {};
+    visit_rect(min, max, [&](std::uint32_t d) {
+        ids.emplace_back(beacons.ids[d]);
+    });
+    std::sort(ids.begin(), ids.end());
+    return ids;
+}
+
+//Palauttaa annetussa suorakulmiossa olevien majakoiden määrän.
+int Datastructures::count_in_rect(Coord min, Coord max)
+{
+    int count = 0;
+    visit_rect(min, max, [&](std::uint32_t) {
+        ++count;
+    });
+    return count;
+}
+
+//Palauttaa k annettua pistettä lähintä majakkaa etäisyyden mukaan nousevassa järjestyksessä, yhtä kaukana
+//olevat id:n mukaan. Soluja käydään läpi renkaittain pisteen solusta alkaen. Renkaan r jälkeen kaikki
+//enintään r*GRID_CELL_SIZE päässä olevat majakat on löydetty, joten haku loppuu, kun k:nneksi lähin on
+//tätä lähempänä. Jos rengas on suurempi kuin ei-tyhjien solujen määrä, käydään loput solut läpi suoraan.
+std::vector<BeaconID> Datastructures::nearest_beacons(Coord xy, int k)
+{
+    if (k <= 0 or beacons.ids.empty()) {
+        return {};
+    }
+    std::size_t wanted = std::min<std::size_t>(k, beacons.ids.size());
+    // Kyselyt eivät käytä majakoiden poolia, jotta niitä voi ajaa rinnakkain
+    std::pmr::monotonic_buffer_resource scratch(std::pmr::new_delete_resource());
+    std::pmr::vector<std::pair<double, std::uint32_t>> candidates(&scratch);
+    auto add_cell = [&](std::int64_t cx, std::int64_t cy) {
+        auto it = gridCells.find(grid_key(cx, cy));
+        if (it != gridCells.end()) {
+            for (auto handle : it->second) {
+                std::uint32_t d = dense_index(handle);
+                candidates.push_back({squared_distance(xy, beacons.coords[d]), d});
+            }
+        }
+    };
+    auto closer = [this](std::pair<double, std::uint32_t> const& c1, std::pair<double, std::uint32_t> const& c2) {
+        return c1.first < c2.first or (c1.first == c2.first and beacons.ids[c1.second] < beacons.ids[c2.second]);
+    };
+
+    std::int64_t cx = grid_cell(xy.x);
+    std::int64_t cy = grid_cell(xy.y);
+    for (std::int64_t r = 0; ; ++r) {
+        if (8 * r > static_cast<std::int64_t>(gridCells.size())) {
+            candidates.clear();
+            for (std::uint32_t d = 0; d < beacons.ids.size(); ++d) {
+                candidates.push_back({squared_distance(xy, beacons.coords[d]), d});
+            }
+            break;
+        }
+        if (r == 0) {
+            add_cell(cx, cy);
+        }
+        else {
+            for (std::int64_t dx = -r; dx <= r; ++dx) {
+                add_cell(cx + dx, cy - r);
+                add_cell(cx + dx, cy + r);
+            }
+            for (std::int64_t dy = -r + 1; dy < r; ++dy) {
+                add_cell(cx - r, cy + dy);
+                add_cell(cx + r, cy + dy);
+            }
+        }
+        if (candidates.size() >= wanted) {
+            std::nth_element(candidates.begin(), candidates.begin() + (wanted - 1), candidates.end(), closer);
+            double reach = static_cast<double>(r) * GRID_CELL_SIZE;
+            if (candidates[wanted - 1].first <= reach * reach) {
+                break;
+            }
+        }
+    }
+
+    std::partial_sort(candidates.begin(), candidates.begin() + wanted, candidates.end(), closer);
+    std::vector<BeaconID> ids = {};
+    ids.reserve(wanted);
+    for (std::size_t i = 0; i < wanted; ++i) {
+        ids.emplace_back(beacons.ids[candidates[i].second]);
+    }
+    return ids;
+}
+
+BeaconIdView<Datastructures::IdIterator> Datastructures::all_beacons_view() const
+{
+    return {beacons.ids.cbegin(), beacons.ids.cend(), beacons.ids.size()};
+}
+
+BeaconIdView<Datastructures::AlphabeticalIterator> Datastructures::beacons_alphabetically_view() const
+{
+    return {AlphabeticalIterator(this, beaconNames.cbegin()), AlphabeticalIterator(this, beaconNames.cend()),
+            beaconNames.size()};
+}
+
+BeaconIdView<Datastructures::BrightnessIterator> Datastructures::beacons_brightness_increasing_view() const
+{
+    return {BrightnessIterator(this, beaconBrightnesses.first()), BrightnessIterator(this, NO_HANDLE),
+            beaconBrightnesses.size()};
+}
+
+void Datastructures::visit_all_beacons(std::function<bool(std::string_view)> const& visit) const
+{
+    for (auto id : all_beacons_view()) {
+        if (!visit(id)) {
+            break;
+        }
+    }
+}
+
+void Datastructures::visit_beacons_alphabetically(std::function<bool(std::string_view)> const& visit) const
+{
+    for (auto id : beacons_alphabetically_view()) {
+        if (!visit(id)) {
+            break;
+        }
+    }
+}
+
+void Datastructures::visit_beacons_brightness_increasing(std::function<bool(std::string_view)> const& visit) const
+{
+    for (auto id : beacons_brightness_increasing_view()) {
+        if (!visit(id)) {
+            break;
+        }
+    }
+}
+
+BeaconID Datastructures::min_brightness()
+{
+    BeaconID minId = NO_ID;
+    if (!beaconBrightnesses.empty()) {
+        minId = beacons.ids[dense_index(beaconBrightnesses.first())];
+    }
+    return minId;
+}
+
+BeaconID Datastructures::max_brightness()
+{
+    BeaconID maxId = NO_ID;
+    if (!beaconBrightnesses.empty()) {
+        maxId = beacons.ids[dense_index(beaconBrightnesses.last())];
+    }
+    return maxId;
+}
+
+//Palauttaa majakan sijan kirkkausjärjestyksessä, kirkkain on sijalla 1. Jos majakkaa ei löydy, palautetaan NO_VALUE.
+int Datastructures::brightness_rank(BeaconID id)
+{
+    BeaconHandle handle = find_handle(id);
+    if (handle == NO_HANDLE) {
+        return NO_VALUE;
+    }
+    std::size_t dimmer = beaconBrightnesses.rank(handle, beacons.brightnesses[dense_index(handle)]);
+    return static_cast<int>(beaconBrightnesses.size() - dimmer);
+}
+
+//Palauttaa k:nneksi kirkkaimman majakan (k = 1 on kirkkain) tai NO_ID, jos k on alueen ulkopuolella.
+BeaconID Datastructures::kth_brightest(int k)
+{
+    if (k < 1 or static_cast<std::size_t>(k) > beaconBrightnesses.size()) {
+        return NO_ID;
+    }
+    BeaconHandle handle = beaconBrightnesses.find_by_order(beaconBrightnesses.size() - k);
+    return BeaconID(beacons.ids[dense_index(handle)]);
+}
+
+//Palauttaa enintään count majakkaa kirkkaimmasta alkaen, ohittaen ensin offset kirkkainta.
+std::vector<BeaconID> Datastructures::brightest_beacons(int count, int offset)
+{
+    std::vector<BeaconID> ids = {};
+    int size = static_cast<int>(beaconBrightnesses.size());
+    if (count <= 0 or offset < 0 or offset >= size) {
+        return ids;
+    }
+    ids.reserve(std::min(count, size - offset));
+    BeaconHandle handle = beaconBrightnesses.find_by_order(size - 1 - offset);
+    for (; handle != NO_HANDLE and static_cast<int>(ids.size()) < count; handle = beaconBrightnesses.prev(handle)) {
+        ids.emplace_back(beacons.ids[dense_index(handle)]);
+    }
+    return ids;
+}
+
+//Palauttaa kirkkausjärjestyksessä majakat, joiden kirkkaus on välillä [lo, hi]. Tuloksista ohitetaan
+//ensin offset ensimmäistä ja palautetaan enintään limit majakkaa, jolloin tuloksia voi selata sivuittain.
+std::vector<BeaconID> Datastructures::beacons_in_brightness_range(int lo, int hi, int offset, int limit)
+{
+    std::vector<BeaconID> ids = {};
+    if (lo > hi or offset < 0 or limit <= 0) {
+        return ids;
+    }
+    std::size_t first = beaconBrightnesses.count_below(lo);
+    std::size_t last = hi == std::numeric_limits<int>::max() ? beaconBrightnesses.size()
+                                                             : beaconBrightnesses.count_below(hi + 1);
+    if (first + offset >= last) {
+        return ids;
+    }
+    std::size_t count = std::min<std::size_t>(last - first - offset, limit);
+    ids.reserve(count);
+    BeaconHandle handle = beaconBrightnesses.find_by_order(first + offset);
+    for (; ids.size() < count; handle = beaconBrightnesses.next(handle)) {
+        ids.emplace_back(beacons.ids[dense_index(handle)]);
+    }
+    return ids;
+}
+
+//Palauttaa majakat, joilla on annettu nimi tai tyhjän vektorin, jos sellaisia ei ole.
+//Nimi-indeksissä saman nimiset majakat ovat jo nousevan ID:n mukaisessa järjestyksessä.
+std::vector<BeaconID> Datastructures::find_beacons(std::string const& name)
+{
+    std::vector<BeaconID> ids = {};
+    auto iterpair = beaconNames.equal_range(name);
+    for (auto it = iterpair.first; it != iterpair.second; ++it) {
+        ids.emplace_back(beacons.ids[dense_index(*it)]);
+    }
+    return ids;
+}
+
+//Palauttaa nousevan ID:n mukaisessa järjestyksessä majakat, joiden nimi alkaa annetulla merkkijonolla.
+std::vector<BeaconID> Datastructures::find_beacons_prefix(std::string const& prefix)
+{
+    std::vector<BeaconID> ids = {};
+    for (auto it = beaconNames.lower_bound(prefix); it != beaconNames.end(); ++it) {
+        std::uint32_t d = dense_index(*it);
+        if (beacons.names[d].compare(0, prefix.size(), prefix) != 0) {
+            break;
+        }
+        ids.emplace_back(beacons.ids[d]);
+    }
+    std::sort(ids.begin(), ids.end());
+    return ids;
+}
+
+//Palauttaa nousevan ID:n mukaisessa järjestyksessä majakat, joiden nimessä annettu merkkijono esiintyy.
+std::vector<BeaconID> Datastructures::find_beacons_substring(std::string const& part)
+{
+    std::vector<BeaconID> ids = {};
+    // Hakusanan trigrammit pidetään paikallisesti, jotta hakuja voi ajaa rinnakkain
+    std::pmr::monotonic_buffer_resource scratch(std::pmr::new_delete_resource());
+    std::pmr::vector<std::uint32_t> trigrams(&scratch);
+    name_trigrams(part, trigrams);
+
+    if (trigrams.empty()) {
+        // Lyhyt hakusana osuu tyypillisesti suureen osaan majakoista, joten käydään nimet läpi
+        for (std::size_t d = 0; d < beacons.names.size(); ++d) {
+            if (beacons.names[d].find(part) != std::string::npos) {
+                ids.emplace_back(beacons.ids[d]);
+            }
+        }
+        std::sort(ids.begin(), ids.end());
+        return ids;
+    }
+
+    // Ehdokkaiksi otetaan harvinaisimman trigrammin majakat
+    std::pmr::vector<BeaconHandle> const* candidates = nullptr;
+    for (auto trigram : trigrams) {
+        auto it = nameTrigrams.find(trigram);
+        if (it == nameTrigrams.end()) {
+            return {};
+        }
+        if (candidates == nullptr or it->second.size() < candidates->size()) {
+            candidates = &it->second;
+        }
+    }
+    for (auto handle : *candidates) {
+        std::uint32_t d = dense_index(handle);
+        if (d != NO_HANDLE and beacons.names[d].find(part) != std::string::npos) {
+            ids.emplace_back(beacons.ids[d]);
+        }
+    }
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    return ids;
+}
+
+void Datastructures::add_name_trigrams(BeaconHandle handle, std::string_view name)
+{
+    name_trigrams(name, trigramScratch);
+    for (auto trigram : trigramScratch) {
+        nameTrigrams[trigram].push_back(handle);
+        ++totalTrigrams;
+    }
+}
+
+void Datastructures::rebuild_name_trigrams()
+{
+    nameTrigrams.clear();
+    staleTrigrams = 0;
+    totalTrigrams = 0;
+    for (std::size_t d = 0; d < beacons.names.size(); ++d) {
+        add_name_trigrams(beacons.handles[d], beacons.names[d]);
+    }
+}
+
+bool Datastructures::NameOrder::operator()(BeaconHandle h1, BeaconHandle h2) const
+{
+    std::uint32_t d1 = ds->dense_index(h1);
+    std::uint32_t d2 = ds->dense_index(h2);
+    int order = ds->beacons.names[d1].compare(ds->beacons.names[d2]);
+    if (order != 0) {
+        return order < 0;
+    }
+    return ds->beacons.ids[d1] < ds->beacons.ids[d2];
+}
+
+bool Datastructures::NameOrder::operator()(BeaconHandle h, std::string_view name) const
+{
+    return std::string_view(ds->beacons.names[ds->dense_index(h)]) < name;
+}
+
+bool Datastructures::NameOrder::operator()(std::string_view name, BeaconHandle h) const
+{
+    return name < std::string_view(ds->beacons.names[ds->dense_index(h)]);
+}
+
+bool Datastructures::change_beacon_name(BeaconID id, const std::string& newname)
+{
+    BeaconHandle handle = find_handle(id);
+    if (handle != NO_HANDLE) {
+        // Indeksin järjestys riippuu nimestä, joten majakka poistetaan ennen nimen vaihtoa
+        beaconNames.erase(handle);
+        std::pmr::string& name = beacons.names[dense_index(handle)];
+        name_trigrams(name, trigramScratch);
+        staleTrigrams += trigramScratch.size();
+        name = newname;
+        beaconNames.insert(handle);
+        add_name_trigrams(handle, newname);
+        update_snapshot_beacon(dense_index(handle));
+        if (journal.is_open()) {
+            journal.record(JournalOp::ChangeName, {}, {id, newname});
+        }
+        if (staleTrigrams > totalTrigrams / 2) {
+            rebuild_name_trigrams();
+        }
+        return true;
+    }
+    return false;
+}
+
+bool Datastructures::change_beacon_color(BeaconID id, Color newcolor)
+{
+    BeaconHandle handle = find_handle(id);
+    if (handle != NO_HANDLE) {
+        std::uint32_t d = dense_index(handle);
+        beaconBrightnesses.erase(handle);
+        beacons.colors[d] = newcolor;
+        update_brightness(handle);
+        beaconBrightnesses.insert(handle, beacons.brightnesses[d]);
+        beamTree.set_brightness(handle, beacons.brightnesses[d]);
+        if (eulerTourUsed) {
+            eulerTour.set_color(handle, newcolor);
+        }
+        update_total_color(handle);
+        update_snapshot_beacon(d);
+        if (journal.is_open()) {
+            journal.record(JournalOp::ChangeColor, {newcolor.r, newcolor.g, newcolor.b}, {id});
+        }
+        return true;
+    }
+    return false;
+}
+
+void Datastructures::link_beam(BeaconHandle source, BeaconHandle target)
+{
+    std::uint32_t s = dense_index(source);
+    std::uint32_t t = dense_index(target);
+    beacons.sending[s] = target;
+    beacons.receivingPos[s] = static_cast<std::uint32_t>(beacons.receiving[t].size());
+    beacons.receiving[t].push_back(source);
+    update_snapshot_beacon(s);
+    invalidate_lift(source);
+    if (eulerTourUsed) {
+        eulerTour.link(source, target);
+    }
+    if (journal.is_open()) {
+        journal.record(JournalOp::AddBeam, {}, {beacons.ids[s], beacons.ids[t]});
+    }
+}
+
+// Lähde ei lähetä valoa, joten se on oman puunsa juuri, ja säde sulkee silmukan täsmälleen silloin,
+// kun kohde on samassa puussa. Jos lähteellä ei ole lähteitä, puussa ei ole muita majakoita.
+bool Datastructures::closes_loop(BeaconHandle source, BeaconHandle target)
+{
+    if (source == target) {
+        return true;
+    }
+    return !beacons.receiving[dense_index(source)].empty() and beamTree.find_root(target) == source;
+}
+
+//Säde hylätään, jos lähde on jo kohteen lähtevän säteen ketjussa, koska säteet muodostaisivat silmukan.
+bool Datastructures::add_lightbeam(BeaconID sourceid, BeaconID targetid)
+{
+    BeaconHandle source = find_handle(sourceid);
+    BeaconHandle target = find_handle(targetid);
+    if (source != NO_HANDLE and target != NO_HANDLE and beacons.sending[dense_index(source)] == NO_HANDLE and
+        !closes_loop(source, target)) {
+        beamTree.link(source, target);
+        link_beam(source, target);
+
+        std::uint32_t s = dense_index(source);
+        Color& sum = beacons.receivedSums[dense_index(target)];
+        sum.r += beacons.totalColors[s].r;
+        sum.g += beacons.totalColors[s].g;
+        sum.b += beacons.totalColors[s].b;
+        update_total_color(target);
+
+        // Pidempi tuleva ketju kasvattaa kohteiden ketjuja niin kauan kuin se on pisin
+        BeaconHandle grown = source;
+        walk_chain(target, &BeaconColumns::sending, [&](std::uint32_t d) {
+            if (!join_longest_sources(d, grown)) {
+                return false;
+            }
+            grown = beacons.handles[d];
+            return true;
+        });
+        return true;
+    }
+    return false;
+}
+
+//Lisää kaikki annetut säteet kerralla samoin ehdoin kuin add_lightbeam (myös silmukan muodostavat
+//säteet hylätään annetussa järjestyksessä). Palauttaa lisättyjen määrän.
+//Kohteiden vastaanottajalistat varataan kerralla oikean kokoisiksi, ja kokonaisvärit ja pisimmät ketjut
+//lasketaan lopuksi kerran jokaiselle puulle, johon säteitä lisättiin.
+int Datastructures::add_lightbeams(std::vector<std::pair<BeaconID, BeaconID>> const& beams)
+{
+    std::pmr::monotonic_buffer_resource scratch(&beaconMemory);
+    std::pmr::vector<std::pair<BeaconHandle, BeaconHandle>> accepted(&scratch);
+    accepted.reserve(beams.size());
+    for (auto const& beam : beams) {
+        BeaconHandle source = find_handle(beam.first);
+        BeaconHandle target = find_handle(beam.second);
+        // Vastaanottajalistat päivitetään vasta lopuksi, joten silmukka tarkistetaan aina juurikyselyllä
+        if (source == NO_HANDLE or target == NO_HANDLE or beacons.sending[dense_index(source)] != NO_HANDLE or
+            source == target or beamTree.find_root(target) == source) {
+            continue;
+        }
+        // Merkitään lähde heti lähettäväksi, jotta sama lähde ei tule hyväksytyksi kahdesti
+        beacons.sending[dense_index(source)] = target;
+        beamTree.link(source, target);
+        accepted.push_back({source, target});
+    }
+    link_new_beams(accepted);
+    return static_cast<int>(accepted.size());
+}
+
+// Kohteiden vastaanottajalistat varataan kerralla oikean kokoisiksi, ja kokonaisvärit ja pisimmät ketjut
+// lasketaan lopuksi kerran jokaiselle puulle, johon säteitä lisättiin.
+void Datastructures::link_new_beams(std::pmr::vector<std::pair<BeaconHandle, BeaconHandle>> const& accepted)
+{
+    std::pmr::monotonic_buffer_resource scratch(&beaconMemory);
+    std::pmr::vector<std::uint32_t> newSources(beacons.ids.size(), 0, &scratch);
+    for (auto const& beam : accepted) {
+        ++newSources[dense_index(beam.second)];
+    }
+    for (std::size_t t = 0; t < newSources.size(); ++t) {
+        if (newSources[t] != 0) {
+            beacons.receiving[t].reserve(beacons.receiving[t].size() + newSources[t]);
+        }
+    }
+    for (auto const& beam : accepted) {
+        link_beam(beam.first, beam.second);
+    }
+
+    // Etsitään muuttuneiden puiden juuret, jokainen majakka käydään enintään kerran
+    std::pmr::vector<bool> visited(beacons.ids.size(), false, &scratch);
+    std::pmr::vector<BeaconHandle> roots(&scratch);
+    for (auto const& beam : accepted) {
+        BeaconHandle root = NO_HANDLE;
+        walk_chain(beam.second, &BeaconColumns::sending, [&](std::uint32_t d) {
+            if (visited[d]) {
+                return false;
+            }
+            visited[d] = true;
+            if (beacons.sending[d] == NO_HANDLE) {
+                root = beacons.handles[d];
+            }
+            return true;
+        });
+        if (root != NO_HANDLE) {
+            roots.push_back(root);
+        }
+    }
+    for (auto root : roots) {
+        recompute_inbeam_caches(root);
+    }
+}
+
+std::vector<BeaconID> Datastructures::get_lightsources(BeaconID id)
+{
+    std::vector<BeaconID> ids;
+    BeaconHandle handle = find_handle(id);
+    if (handle != NO_HANDLE) {
+        for (auto beam : beacons.receiving[dense_index(handle)]) {
+            ids.emplace_back(beacons.ids[dense_index(beam)]);
+        }
+        std::sort(ids.begin(), ids.end());
+        return ids;
+    }
+    return {{NO_ID}};
+}
+
+// Puun yläosa käydään leveyssuunnassa, kunnes reunalla on tarpeeksi erillisiä alipuita. Säikeet ottavat
+// reunan alipuita jaetusta laskurista ja laskevat ne jälkijärjestyksessä; jokainen majakka kirjoitetaan vain
+// omiin sarakealkioihinsa, joten säikeet eivät kilpaile. Lopuksi yläosa lasketaan käänteisessä järjestyksessä,
+// jolloin lähteet ovat aina valmiina. Kapeat puut (kuten pitkät ketjut) ja pienet puut lasketaan yhdellä säikeellä.
+void Datastructures::recompute_inbeam_caches(BeaconHandle root)
+{
+    unsigned threads = evaluatorThreads != 0 ? evaluatorThreads : std::max(1u, std::thread::hardware_concurrency());
+    auto compute = [this](std::uint32_t d) { compute_inbeam_cache(d); };
+    if (threads <= 1) {
+        walk_inbeam_postorder(root, compute);
+        return;
+    }
+
+    std::vector<std::uint32_t> top;
+    std::vector<BeaconHandle> frontier = {root};
+    std::vector<BeaconHandle> next;
+    while (!frontier.empty() and frontier.size() < PARALLEL_MIN_SUBTREES and top.size() < PARALLEL_MAX_TOP) {
+        next.clear();
+        for (auto handle : frontier) {
+            std::uint32_t d = dense_index(handle);
+            top.push_back(d);
+            next.insert(next.end(), beacons.receiving[d].begin(), beacons.receiving[d].end());
+        }
+        frontier.swap(next);
+    }
+
+    if (frontier.size() < PARALLEL_MIN_SUBTREES) {
+        for (auto handle : frontier) {
+            walk_inbeam_postorder(handle, compute);
+        }
+    }
+    else {
+        std::atomic<std::size_t> nextChunk(0);
+        auto worker = [&]() {
+            std::pmr::vector<std::pair<BeaconHandle, std::uint32_t>> stack(std::pmr::new_delete_resource());
+            for (;;) {
+                std::size_t begin = nextChunk.fetch_add(PARALLEL_CHUNK);
+                if (begin >= frontier.size()) {
+                    return;
+                }
+                std::size_t end = std::min(begin + PARALLEL_CHUNK, frontier.size());
+                for (std::size_t i = begin; i < end; ++i) {
+                    walk_inbeam_postorder(frontier[i], stack, compute);
+                }
+            }
+        };
+        std::vector<std::thread> workers;
+        for (unsigned t = 1; t < threads; ++t) {
+            workers.emplace_back(worker);
+        }
+        worker();
+        for (auto& thread : workers) {
+            thread.join();
+        }
+    }
+
+    for (auto d = top.rbegin(); d != top.rend(); ++d) {
+        compute_inbeam_cache(*d);
+    }
+}
+
+// Majakka järjestää vain oman lähdelistansa ja lähteidensä sijainnit, joten rinnakkaiset säikeet eivät kilpaile
+void Datastructures::compute_inbeam_cache(std::uint32_t d)
+{
+    Color sum = {0, 0, 0};
+    for (auto source : beacons.receiving[d]) {
+        std::uint32_t sd = dense_index(source);
+        sum.r += beacons.totalColors[sd].r;
+        sum.g += beacons.totalColors[sd].g;
+        sum.b += beacons.totalColors[sd].b;
+    }
+    Color const& color = beacons.colors[d];
+    int divider = static_cast<int>(beacons.receiving[d].size()+1);
+    beacons.receivedSums[d] = sum;
+    beacons.totalColors[d] = {(color.r + sum.r) / divider, (color.g + sum.g) / divider, (color.b + sum.b) / divider};
+    rebuild_longest_sources(d);
+}
+
+void Datastructures::set_evaluator_threads(unsigned threads)
+{
+    evaluatorThreads = threads;
+}
+
+std::vector<BeaconID> Datastructures::path_outbeam(BeaconID id)
+{
+    BeaconHandle handle = find_handle(id);
+    if (handle == NO_HANDLE) {
+        return {{NO_ID}};
+    }
+    std::vector<BeaconID> beams;
+    walk_chain(handle, &BeaconColumns::sending, [&](std::uint32_t d) {
+        beams.emplace_back(beacons.ids[d]);
+        return true;
+    });
+    return beams;
+}
+
+//Valitsee, käyttävätkö ulospäin suuntautuvat kyselyt link-cut-puuta vai kävelevätkö ne ketjua.
+//Puu pidetään aina ajan tasalla silmukoiden tunnistamista varten, joten kytkin ei muuta sitä.
+void Datastructures::enable_beam_tree(bool enabled)
+{
+    beamTreeEnabled = enabled;
+}
+
+//Palauttaa majakan lähtevän säteen ketjun viimeisen majakan (joka ei lähetä valoa eteenpäin).
+//Jos majakkaa ei löydy, palautetaan NO_ID.
+BeaconID Datastructures::find_sink(BeaconID id)
+{
+    BeaconHandle handle = find_handle(id);
+    if (handle == NO_HANDLE) {
+        return NO_ID;
+    }
+    if (beamTreeEnabled) {
+        return BeaconID(beacons.ids[dense_index(beamTree.find_root(handle))]);
+    }
+    std::uint32_t sink = dense_index(handle);
+    walk_chain(handle, &BeaconColumns::sending, [&](std::uint32_t d) {
+        sink = d;
+        return true;
+    });
+    return BeaconID(beacons.ids[sink]);
+}
+
+//Palauttaa path_outbeamin palauttaman ketjun pituuden majakka itse mukaan lukien. Jos majakkaa ei löydy,
+//palautetaan NO_VALUE.
+int Datastructures::outbeam_length(BeaconID id)
+{
+    BeaconHandle handle = find_handle(id);
+    if (handle == NO_HANDLE) {
+        return NO_VALUE;
+    }
+    if (beamTreeEnabled) {
+        return static_cast<int>(beamTree.depth(handle)) + 1;
+    }
+    int length = 0;
+    walk_chain(handle, &BeaconColumns::sending, [&](std::uint32_t) {
+        ++length;
+        return true;
+    });
+    return length;
+}
+
+//Palauttaa kirkkaimman majakan lähtevän säteen ketjulta majakka itse mukaan lukien. Tasapelissä palautetaan
+//ketjulla ensimmäinen. Jos majakkaa ei löydy, palautetaan NO_ID.
+BeaconID Datastructures::brightest_on_outbeam(BeaconID id)
+{
+    BeaconHandle handle = find_handle(id);
+    if (handle == NO_HANDLE) {
+        return NO_ID;
+    }
+    if (beamTreeEnabled) {
+        return BeaconID(beacons.ids[dense_index(beamTree.path_max(handle))]);
+    }
+    std::uint32_t brightest = dense_index(handle);
+    walk_chain(handle, &BeaconColumns::sending, [&](std::uint32_t d) {
+        if (beacons.brightnesses[d] > beacons.brightnesses[brightest]) {
+            brightest = d;
+        }
+        return true;
+    });
+    return BeaconID(beacons.ids[brightest]);
+}
+
+//Palauttaa himmeimmän majakan lähtevän säteen ketjulta majakka itse mukaan lukien. Tasapelissä palautetaan
+//ketjulla ensimmäinen. Jos majakkaa ei löydy, palautetaan NO_ID.
+BeaconID Datastructures::dimmest_on_outbeam(BeaconID id)
+{
+    BeaconHandle handle = find_handle(id);
+    if (handle == NO_HANDLE) {
+        return NO_ID;
+    }
+    if (beamTreeEnabled) {
+        return BeaconID(beacons.ids[dense_index(beamTree.path_min(handle))]);
+    }
+    std::uint32_t dimmest = dense_index(handle);
+    walk_chain(handle, &BeaconColumns::sending, [&](std::uint32_t d) {
+        if (beacons.brightnesses[d] < beacons.brightnesses[dimmest]) {
+            dimmest = d;
+        }
+        return true;
+    });
+    return BeaconID(beacons.ids[dimmest]);
+}
+
+//Palauttaa lähtevän säteen ketjun majakoiden kirkkauksien summan majakka itse mukaan lukien. Jos majakkaa
+//ei löydy, palautetaan NO_VALUE.
+std::int64_t Datastructures::outbeam_brightness_sum(BeaconID id)
+{
+    BeaconHandle handle = find_handle(id);
+    if (handle == NO_HANDLE) {
+        return NO_VALUE;
+    }
+    if (beamTreeEnabled) {
+        return beamTree.path_sum(handle);
+    }
+    std::int64_t sum = 0;
+    walk_chain(handle, &BeaconColumns::sending, [&](std::uint32_t d) {
+        sum += beacons.brightnesses[d];
+        return true;
+    });
+    return sum;
+}
+
+//Palauttaa majakan, johon majakan valo päätyy k säteen jälkeen (k = 0 on majakka itse). Jos majakkaa ei löydy
+//tai ketju loppuu ennen k:ta sädettä, palautetaan NO_ID.
+BeaconID Datastructures::kth_downstream(BeaconID id, int k)
+{
+    BeaconHandle handle = find_handle(id);
+    if (handle == NO_HANDLE or k < 0) {
+        return NO_ID;
+    }
+    prepare_lift_index();
+    ensure_lift(handle);
+    if (static_cast<std::uint32_t>(k) > liftDepths[handle]) {
+        return NO_ID;
+    }
+    for (std::size_t j = 0; k != 0; ++j, k >>= 1) {
+        if (k & 1) {
+            handle = liftTable[handle * liftLevels + j];
+        }
+    }
+    return BeaconID(beacons.ids[dense_index(handle)]);
+}
+
+//Palauttaa ensimmäisen majakan, johon molempien majakoiden valo päätyy (majakka itse mukaan lukien).
+//Jos majakoiden valo ei päädy samaan majakkaan tai jompaakumpaa ei löydy, palautetaan NO_ID.
+BeaconID Datastructures::first_common_receiver(BeaconID id1, BeaconID id2)
+{
+    BeaconHandle h1 = find_handle(id1);
+    BeaconHandle h2 = find_handle(id2);
+    if (h1 == NO_HANDLE or h2 == NO_HANDLE) {
+        return NO_ID;
+    }
+    prepare_lift_index();
+    ensure_lift(h1);
+    ensure_lift(h2);
+    if (liftDepths[h1] < liftDepths[h2]) {
+        std::swap(h1, h2);
+    }
+    // Nostetaan syvempi majakka samalle syvyydelle
+    std::uint32_t difference = liftDepths[h1] - liftDepths[h2];
+    for (std::size_t j = 0; difference != 0; ++j, difference >>= 1) {
+        if (difference & 1) {
+            h1 = liftTable[h1 * liftLevels + j];
+        }
+    }
+    if (h1 == h2) {
+        return BeaconID(beacons.ids[dense_index(h1)]);
+    }
+    // Nostetaan molempia niin pitkälle kuin ne eivät vielä kohtaa
+    for (std::size_t j = liftLevels; j-- > 0;) {
+        BeaconHandle up1 = liftTable[h1 * liftLevels + j];
+        BeaconHandle up2 = liftTable[h2 * liftLevels + j];
+        if (up1 != up2) {
+            h1 = up1;
+            h2 = up2;
+        }
+    }
+    BeaconHandle common = liftTable[h1 * liftLevels];
+    return common == NO_HANDLE ? NO_ID : BeaconID(beacons.ids[dense_index(common)]);
+}
+
+//Palauttaa true, jos ensimmäisen majakan valo päätyy toiseen majakkaan (toinen on ensimmäisen lähtevän
+//säteen ketjussa). Majakka ei ole itsensä yläjuoksulla. Jos jompaakumpaa ei löydy, palautetaan false.
+bool Datastructures::is_upstream(BeaconID id1, BeaconID id2)
+{
+    BeaconHandle h1 = find_handle(id1);
+    BeaconHandle h2 = find_handle(id2);
+    if (h1 == NO_HANDLE or h2 == NO_HANDLE) {
+        return false;
+    }
+    prepare_euler_tour();
+    return eulerTour.is_inside(h1, h2);
+}
+
+//Palauttaa majakan ja kaikkien majakoiden, joiden valo päätyy siihen, määrän. Jos majakkaa ei löydy,
+//palautetaan NO_VALUE.
+int Datastructures::inbeam_tree_size(BeaconID id)
+{
+    BeaconHandle handle = find_handle(id);
+    if (handle == NO_HANDLE) {
+        return NO_VALUE;
+    }
+    prepare_euler_tour();
+    return static_cast<int>(eulerTour.inbeam_totals(handle).beacons);
+}
+
+//Palauttaa majakan ja kaikkien majakoiden, joiden valo päätyy siihen, omien värien summan. Jos majakkaa
+//ei löydy, palautetaan NO_COLOR.
+Color Datastructures::inbeam_tree_color_sum(BeaconID id)
+{
+    BeaconHandle handle = find_handle(id);
+    if (handle == NO_HANDLE) {
+        return NO_COLOR;
+    }
+    prepare_euler_tour();
+    BeamEulerTour::Totals totals = eulerTour.inbeam_totals(handle);
+    return {static_cast<int>(totals.r), static_cast<int>(totals.g), static_cast<int>(totals.b)};
+}
+
+// Jokainen puu kierretään juurestaan: majakan avaava merkki lisätään, kun se kohdataan, ja sulkeva,
+// kun sen kaikki lähteet on kierretty
+void Datastructures::prepare_euler_tour()
+{
+    if (eulerTourUsed) {
+        return;
+    }
+    eulerTourUsed = true;
+    for (std::uint32_t d = 0; d < beacons.ids.size(); ++d) {
+        eulerTour.reset(beacons.handles[d], beacons.colors[d]);
+    }
+    std::pmr::monotonic_buffer_resource scratch(&beaconMemory);
+    std::pmr::vector<std::uint32_t> tokens(&scratch);
+    for (std::uint32_t d = 0; d < beacons.ids.size(); ++d) {
+        if (beacons.sending[d] != NO_HANDLE or beacons.receiving[d].empty()) {
+            continue;
+        }
+        tokens.clear();
+        traversalStack.clear();
+        traversalStack.push_back({beacons.handles[d], 0});
+        tokens.push_back(2 * beacons.handles[d]);
+        while (!traversalStack.empty()) {
+            auto& top = traversalStack.back();
+            auto const& sources = beacons.receiving[dense_index(top.first)];
+            if (top.second < sources.size()) {
+                BeaconHandle source = sources[top.second++];
+                tokens.push_back(2 * source);
+                traversalStack.push_back({source, 0});
+            }
+            else {
+                tokens.push_back(2 * top.first + 1);
+                traversalStack.pop_back();
+            }
+        }
+        eulerTour.build(tokens);
+    }
+}
+
+// Ketjun syvyys on pienempi kuin kahvojen määrä, joten tasoja tarvitaan kahvojen määrän bittien verran
+void Datastructures::prepare_lift_index()
+{
+    std::size_t handles = beaconSlots.size();
+    std::size_t levels = 1;
+    while ((std::size_t(1) << levels) <= handles) {
+        ++levels;
+    }
+    if (levels > liftLevels) {
+        liftLevels = levels;
+        liftTable.assign(handles * liftLevels, NO_HANDLE);
+        liftValid.assign(handles, 0);
+        liftDepths.assign(handles, 0);
+    }
+    else if (liftValid.size() < handles) {
+        liftTable.resize(handles * liftLevels, NO_HANDLE);
+        liftValid.resize(handles, 0);
+        liftDepths.resize(handles, 0);
+    }
+    liftIndexUsed = true;
+}
+
+// Noustaan kohteiden suuntaan ensimmäiseen voimassa olevaan riviin (tai ketjun loppuun) ja lasketaan
+// rivit sieltä alaspäin, jolloin jokaisen rivin kaikki kohteet ovat jo valmiita.
+void Datastructures::ensure_lift(BeaconHandle handle)
+{
+    liftStack.clear();
+    for (BeaconHandle current = handle; current != NO_HANDLE and !liftValid[current];
+         current = beacons.sending[dense_index(current)]) {
+        liftStack.push_back(current);
+    }
+    while (!liftStack.empty()) {
+        BeaconHandle current = liftStack.back();
+        liftStack.pop_back();
+        BeaconHandle target = beacons.sending[dense_index(current)];
+        BeaconHandle* row = &liftTable[current * liftLevels];
+        row[0] = target;
+        liftDepths[current] = target == NO_HANDLE ? 0 : liftDepths[target] + 1;
+        for (std::size_t j = 1; j < liftLevels; ++j) {
+            row[j] = row[j - 1] == NO_HANDLE ? NO_HANDLE : liftTable[row[j - 1] * liftLevels + j - 1];
+        }
+        liftValid[current] = 1;
+    }
+}
+
+void Datastructures::invalidate_lift(BeaconHandle handle)
+{
+    if (!liftIndexUsed or handle >= liftValid.size() or !liftValid[handle]) {
+        return;
+    }
+    liftStack.clear();
+    liftStack.push_back(handle);
+    liftValid[handle] = 0;
+    while (!liftStack.empty()) {
+        BeaconHandle current = liftStack.back();
+        liftStack.pop_back();
+        for (BeaconHandle source : beacons.receiving[dense_index(current)]) {
+            if (source < liftValid.size() and liftValid[source]) {
+                liftValid[source] = 0;
+                liftStack.push_back(source);
+            }
+        }
+    }
+}
+
+bool Datastructures::remove_beacon(BeaconID id)
+{
+    BeaconHandle handle = find_handle(id);
+    if (handle == NO_HANDLE) {
+        return false;
+    }
+    if (journal.is_open()) {
+        journal.record(JournalOp::RemoveBeacon, {}, {id});
+    }
+    std::uint32_t d = dense_index(handle);
+    beaconBrightnesses.erase(handle);
+    beaconNames.erase(handle);
+    remove_from_grid(d);
+    name_trigrams(beacons.names[d], trigramScratch);
+    staleTrigrams += trigramScratch.size();
+    BeaconHandle target = beacons.sending[d];
+    bool longestLost = false;
+    if (target != NO_HANDLE) {
+        // Siirretään kohteen viimeinen lähde poistettavan paikalle, jolloin poisto on O(1)
+        std::uint32_t t = dense_index(target);
+        std::pmr::vector<BeaconHandle>& targetReceiving = beacons.receiving[t];
+        // Pisimpien lähteiden ryhmästä poistuva lähde siirtyy ensin ryhmän ulkopuolelle
+        longestLost = beacons.receivingPos[d] < beacons.longestCounts[t] and leave_longest_sources(t, handle);
+        std::uint32_t pos = beacons.receivingPos[d];
+        targetReceiving[pos] = targetReceiving.back();
+        beacons.receivingPos[dense_index(targetReceiving[pos])] = pos;
+        targetReceiving.pop_back();
+
+        Color& sum = beacons.receivedSums[t];
+        sum.r -= beacons.totalColors[d].r;
+        sum.g -= beacons.totalColors[d].g;
+        sum.b -= beacons.totalColors[d].b;
+        beamTree.cut(handle);
+        if (eulerTourUsed) {
+            eulerTour.cut(handle);
+        }
+    }
+    invalidate_lift(handle);
+    for (auto source : beacons.receiving[d]) {
+        beacons.sending[dense_index(source)] = NO_HANDLE;
+        update_snapshot_beacon(dense_index(source));
+        beamTree.cut(source);
+        if (eulerTourUsed) {
+            eulerTour.cut(source);
+        }
+    }
+    if (snapshotsEnabled) {
+        currentVersion.beacons = currentVersion.beacons.erase(BeaconID(beacons.ids[d]));
+        ++currentVersion.versionNumber;
+    }
+
+    // Siirretään viimeinen majakka poistettavan paikalle ja lyhennetään sarakkeita
+    std::string_view internedId = beacons.ids[d];
+    std::uint32_t last = static_cast<std::uint32_t>(beacons.ids.size() - 1);
+    if (d != last) {
+        beacons.ids[d] = beacons.ids[last];
+        beacons.coords[d] = beacons.coords[last];
+        beacons.names[d] = std::move(beacons.names[last]);
+        beacons.colors[d] = beacons.colors[last];
+        beacons.brightnesses[d] = beacons.brightnesses[last];
+        beacons.sending[d] = beacons.sending[last];
+        beacons.receiving[d] = std::move(beacons.receiving[last]);
+        beacons.receivingPos[d] = beacons.receivingPos[last];
+        beacons.gridPos[d] = beacons.gridPos[last];
+        beacons.totalColors[d] = beacons.totalColors[last];
+        beacons.receivedSums[d] = beacons.receivedSums[last];
+        beacons.inbeamHeights[d] = beacons.inbeamHeights[last];
+        beacons.longestSources[d] = beacons.longestSources[last];
+        beacons.longestCounts[d] = beacons.longestCounts[last];
+        beacons.handles[d] = beacons.handles[last];
+        beaconSlots[beacons.handles[d]].dense = d;
+    }
+    beacons.ids.pop_back();
+    beacons.coords.pop_back();
+    beacons.names.pop_back();
+    beacons.colors.pop_back();
+    beacons.brightnesses.pop_back();
+    beacons.sending.pop_back();
+    beacons.receiving.pop_back();
+    beacons.receivingPos.pop_back();
+    beacons.gridPos.pop_back();
+    beacons.totalColors.pop_back();
+    beacons.receivedSums.pop_back();
+    beacons.inbeamHeights.pop_back();
+    beacons.longestSources.pop_back();
+    beacons.longestCounts.pop_back();
+    beacons.handles.pop_back();
+
+    beaconSlots[handle].dense = NO_HANDLE;
+    ++beaconSlots[handle].generation;
+    freeSlots.push_back(handle);
+    beaconHandles.erase(internedId);
+    if (!internedId.empty()) {
+        beaconMemory.deallocate(const_cast<char*>(internedId.data()), internedId.size(), 1);
+    }
+    if (staleTrigrams > totalTrigrams / 2) {
+        rebuild_name_trigrams();
+    }
+    if (target != NO_HANDLE) {
+        update_total_color(target);
+    }
+    if (longestLost) {
+        update_inbeam_height(target);
+    }
+    return true;
+}
+
+//Palauttaa pisimmän majakkaketjun, jota pitkin valo tulee annettuun majakkaan. Ensimmäisenä on ketjun alku
+//ja viimeisenä majakka itse. Jos id:llä ei ole majakkaa, palautetaan vektori, jonka ainoa alkio on NO_ID.
+std::vector<BeaconID> Datastructures::path_inbeam_longest(BeaconID id)
+{
+    BeaconHandle handle = find_handle(id);
+    if (handle == NO_HANDLE) {
+        return {NO_ID};
+    }
+    // Ketjun pituus tiedetään, joten polku kirjoitetaan suoraan lopusta alkuun
+    std::vector<BeaconID> path(beacons.inbeamHeights[dense_index(handle)]);
+    auto it = path.rbegin();
+    walk_chain(handle, &BeaconColumns::longestSources, [&](std::uint32_t d) {
+        *it++ = beacons.ids[d];
+        return true;
+    });
+    return path;
+}
+
+// Lasketaan majakan pisin tuleva ketju uudelleen sen lähteistä. Jos ketju lyheni ja majakka kuului kohteensa
+// pisimpien lähteiden ryhmään, se poistuu ryhmästä. Kohde lasketaan uudelleen vain, jos ryhmä tyhjeni;
+// muuten jokin toinen lähde jatkaa yhtä pitkää ketjua.
+void Datastructures::update_inbeam_height(BeaconHandle handle)
+{
+    walk_chain(handle, &BeaconColumns::sending, [this](std::uint32_t d) {
+        int oldHeight = beacons.inbeamHeights[d];
+        rebuild_longest_sources(d);
+        if (beacons.inbeamHeights[d] == oldHeight) {
+            return false;
+        }
+        BeaconHandle target = beacons.sending[d];
+        if (target == NO_HANDLE) {
+            return false;
+        }
+        std::uint32_t t = dense_index(target);
+        return beacons.receivingPos[d] < beacons.longestCounts[t] and leave_longest_sources(t, beacons.handles[d]);
+    });
+}
+
+// Pisimmän ketjun lähteet vaihdetaan listan alkuun löytymisjärjestyksessä, joten ensimmäinen niistä säilyy
+// ensimmäisenä
+void Datastructures::rebuild_longest_sources(std::uint32_t d)
+{
+    auto& sources = beacons.receiving[d];
+    int height = 1;
+    for (auto source : sources) {
+        height = std::max(height, beacons.inbeamHeights[dense_index(source)] + 1);
+    }
+    std::uint32_t count = 0;
+    if (height > 1) {
+        for (std::uint32_t pos = 0; pos < sources.size(); ++pos) {
+            if (beacons.inbeamHeights[dense_index(sources[pos])] + 1 == height) {
+                swap_sources(d, pos, count++);
+            }
+        }
+    }
+    beacons.inbeamHeights[d] = height;
+    beacons.longestCounts[d] = count;
+    beacons.longestSources[d] = count == 0 ? NO_HANDLE : sources[0];
+}
+
+// Uusi pisin lähde aloittaa ryhmän yksin listan alussa; yhtä pitkä lähde liitetään ryhmän perään
+bool Datastructures::join_longest_sources(std::uint32_t t, BeaconHandle source)
+{
+    int height = beacons.inbeamHeights[dense_index(source)] + 1;
+    std::uint32_t pos = beacons.receivingPos[dense_index(source)];
+    if (height > beacons.inbeamHeights[t]) {
+        swap_sources(t, pos, 0);
+        beacons.inbeamHeights[t] = height;
+        beacons.longestCounts[t] = 1;
+        beacons.longestSources[t] = source;
+        return true;
+    }
+    if (height == beacons.inbeamHeights[t] and pos >= beacons.longestCounts[t]) {
+        swap_sources(t, pos, beacons.longestCounts[t]++);
+    }
+    return false;
+}
+
+bool Datastructures::leave_longest_sources(std::uint32_t t, BeaconHandle source)
+{
+    std::uint32_t count = --beacons.longestCounts[t];
+    swap_sources(t, beacons.receivingPos[dense_index(source)], count);
+    beacons.longestSources[t] = count == 0 ? NO_HANDLE : beacons.receiving[t][0];
+    return count == 0;
+}
+
+void Datastructures::swap_sources(std::uint32_t t, std::uint32_t pos1, std::uint32_t pos2)
+{
+    auto& sources = beacons.receiving[t];
+    std::swap(sources[pos1], sources[pos2]);
+    beacons.receivingPos[dense_index(sources[pos1])] = pos1;
+    beacons.receivingPos[dense_index(sources[pos2])] = pos2;
+}
+
+// Kokonaisväri on majakan oman värin ja lähteiden kokonaisvärien keskiarvo. Kun majakan kokonaisväri muuttuu,
+// muutos lisätään kohdemajakan summaan ja kohteen kokonaisväri lasketaan uudestaan, kunnes väri ei enää muutu.
+void Datastructures::update_total_color(BeaconHandle handle)
+{
+    walk_chain(handle, &BeaconColumns::sending, [this](std::uint32_t d) {
+        Color const& color = beacons.colors[d];
+        Color const& sum = beacons.receivedSums[d];
+        int divider = static_cast<int>(beacons.receiving[d].size()+1);
+        Color newTotal = {(color.r + sum.r) / divider, (color.g + sum.g) / divider, (color.b + sum.b) / divider};
+
+        Color& oldTotal = beacons.totalColors[d];
+        if (newTotal == oldTotal) {
+            return false;
+        }
+        BeaconHandle target = beacons.sending[d];
+        if (target != NO_HANDLE) {
+            Color& targetSum = beacons.receivedSums[dense_index(target)];
+            targetSum.r += newTotal.r - oldTotal.r;
+            targetSum.g += newTotal.g - oldTotal.g;
+            targetSum.b += newTotal.b - oldTotal.b;
+        }
+        oldTotal = newTotal;
+        return true;
+    });
+}
+
+Color Datastructures::total_color(BeaconID id)
+{
+    BeaconHandle handle = find_handle(id);
+    if (handle == NO_HANDLE) {
+        return NO_COLOR;
+    }
+    return beacons.totalColors[dense_index(handle)];
+}
+
+BeaconRef Datastructures::beacon_ref(BeaconID id)
+{
+    BeaconHandle handle = find_handle(id);
+    if (handle == NO_HANDLE) {
+        return NO_REF;
+    }
+    return {handle, beaconSlots[handle].generation};
+}
+
+bool Datastructures::is_valid(BeaconRef ref)
+{
+    return ref.handle < beaconSlots.size() and beaconSlots[ref.handle].generation == ref.generation
+            and beaconSlots[ref.handle].dense != NO_HANDLE;
+}
+
+BeaconID Datastructures::get_id(BeaconRef ref)
+{
+    if (is_valid(ref)) {
+        return BeaconID(beacons.ids[dense_index(ref.handle)]);
+    }
+    return NO_ID;
+}
+
+std::string Datastructures::get_name(BeaconRef ref)
+{
+    if (is_valid(ref)) {
+        return std::string(beacons.names[dense_index(ref.handle)]);
+    }
+    return NO_NAME;
+}
+
+Coord Datastructures::get_coordinates(BeaconRef ref)
+{
+    if (is_valid(ref)) {
+        return beacons.coords[dense_index(ref.handle)];
+    }
+    return NO_COORD;
+}
+
+Color Datastructures::get_color(BeaconRef ref)
+{
+    if (is_valid(ref)) {
+        return beacons.colors[dense_index(ref.handle)];
+    }
+    return NO_COLOR;
+}
+
+std::pair<Coord, Coord> Datastructures::swapCoords(std::pair<Coord, Coord> point)
+{
+    if (operator<(point.second, point.first)) {
+        std::swap(point.first, point.second);
+    }
+    return point;
+}
+
+std::uint64_t DataSnapshot::version() const
+{
+    return versionNumber;
+}
+
+int DataSnapshot::beacon_count() const
+{
+    return static_cast<int>(beacons.size());
+}
+
+std::vector<BeaconID> DataSnapshot::all_beacons() const
+{
+    std::vector<BeaconID> ids = {};
+    ids.reserve(beacons.size());
+    beacons.visit_all([&](BeaconID const& id, BeaconRecord const&) {
+        ids.push_back(id);
+        return true;
+    });
+    return ids;
+}
+
+BeaconRecord DataSnapshot::get_beacon(BeaconID const& id) const
+{
+    BeaconRecord const* record = beacons.find(id);
+    return record != nullptr ? *record : BeaconRecord{};
+}
+
+std::vector<BeaconID> DataSnapshot::path_outbeam(BeaconID const& id) const
+{
+    if (beacons.find(id) == nullptr) {
+        return {NO_ID};
+    }
+    std::vector<BeaconID> path = {};
+    for (BeaconID current = id; current != NO_ID; current = beacons.find(current)->target) {
+        path.push_back(current);
+    }
+    return path;
+}
+
+std::vector<Coord> DataSnapshot::all_xpoints() const
+{
+    std::vector<Coord> xpoints = {};
+    fibres.visit_all([&](std::pair<Coord, Coord> const& fibre, Cost) {
+        if (xpoints.empty() or xpoints.back() != fibre.first) {
+            xpoints.push_back(fibre.first);
+        }
+        return true;
+    });
+    return xpoints;
+}
+
+// Kuidut ovat puussa molempiin suuntiin ensimmäisen pisteen mukaan järjestyksessä, joten pisteen kuidut
+// ovat peräkkäin alkaen parista (piste, pienin mahdollinen koordinaatti).
+std::vector<std::pair<Coord, Cost>> DataSnapshot::get_fibres_from(Coord xpoint) const
+{
+    std::vector<std::pair<Coord, Cost>> coords = {};
+    fibres.visit_from({xpoint, NO_COORD}, [&](std::pair<Coord, Coord> const& fibre, Cost cost) {
+        if (fibre.first != xpoint) {
+            return false;
+        }
+        coords.push_back({fibre.second, cost});
+        return true;
+    });
+    return coords;
+}
+
+std::vector<std::pair<Coord, Coord>> DataSnapshot::all_fibres() const
+{
+    std::vector<std::pair<Coord, Coord>> result = {};
+    fibres.visit_all([&](std::pair<Coord, Coord> const& fibre, Cost) {
+        if (fibre.first < fibre.second) {
+            result.push_back(fibre);
+        }
+        return true;
+    });
+    return result;
+}
+
+// Leveyshaku, jossa jokaiselle pisteelle tallennetaan piste, josta siihen tultiin. Naapurit käydään läpi
+// koordinaattien mukaisessa järjestyksessä kuten Datastructures::route_least_xpointsissa.
+std::vector<std::pair<Coord, Cost>> DataSnapshot::route_least_xpoints(Coord fromxpoint, Coord toxpoint) const
+{
+    if (fromxpoint == toxpoint or get_fibres_from(fromxpoint).empty() or get_fibres_from(toxpoint).empty()) {
+        return {};
+    }
+    std::map<Coord, std::pair<Coord, Cost>> cameFrom = {{fromxpoint, {NO_COORD, 0}}};
+    std::list<Coord> queue = {fromxpoint};
+    while (!queue.empty() and cameFrom.find(toxpoint) == cameFrom.end()) {
+        Coord current = queue.front();
+        queue.pop_front();
+        for (auto const& fibre : get_fibres_from(current)) {
+            if (cameFrom.insert({fibre.first, {current, fibre.second}}).second) {
+                queue.push_back(fibre.first);
+            }
+        }
+    }
+    auto found = cameFrom.find(toxpoint);
+    if (found == cameFrom.end()) {
+        return {};
+    }
+    std::vector<std::pair<Coord, Cost>> route = {};
+    for (Coord current = toxpoint; current != NO_COORD; current = cameFrom.at(current).first) {
+        route.push_back({current, cameFrom.at(current).second});
+    }
+    std::reverse(route.begin(), route.end());
+    for (std::size_t i = 1; i < route.size(); ++i) {
+        route[i].second += route[i-1].second;
+    }
+    return route;
+}
+
+// Palauttaa kaikki tietorakenteessa olevat kuitujen päätepisteet koordinaattien mukaisessa järjestyksessä
+// ja jokainen päätepiste on mukana vain kerran.
+std::vector<Coord> Datastructures::all_xpoints()
+{
+    std::vector<Coord> xpoints = {};
+    for (auto const& x : allFibres) {
+        if (std::find(xpoints.begin(), xpoints.end(), x.first) == xpoints.end()) {
+            xpoints.push_back(x.first);
+        }
+    }
+    return xpoints;
+}
+
+// Lisää tietorakenteeseen uuden valokuidun annettujen pisteiden välille ja annetulla hinnalla.
+// Jos annettujen pisteiden välillä on jo kuitu tai jos molemmat pisteet ovat samat, ei tehdä mitään ja palautetaan false, muuten palautetaan true
+bool Datastructures::add_fibre(Coord xpoint1, Coord xpoint2, Cost cost)
+{
+    std::pair<Coord, Coord> points = swapCoords(std::make_pair(xpoint1, xpoint2));
+
+    if (xpoint1 == xpoint2 or fibreCoords.find(points) != fibreCoords.end()) {
+        return false;
+    }
+
+    // Uuden pisteen kuitumappi luodaan kuitujen muistiin, jotta sekin vapautuu clear_fibresissa
+    auto first = allFibres.find(points.first);
+    if (first == allFibres.end()) {
+        first = allFibres.emplace(points.first, Xpoint{points.first, std::pmr::map<Coord, Cost>(&fibreMemory)}).first;
+    }
+    first->second.fibres.insert({points.second, cost});
+
+    auto second = allFibres.find(points.second);
+    if (second == allFibres.end()) {
+        second = allFibres.emplace(points.second, Xpoint{points.second, std::pmr::map<Coord, Cost>(&fibreMemory)}).first;
+    }
+    second->second.fibres.insert({points.first, cost});
+
+    fibreCoords[points] = cost;
+    if (snapshotsEnabled) {
+        currentVersion.fibres = currentVersion.fibres.insert(points, cost).insert({points.second, points.first}, cost);
+        ++currentVersion.versionNumber;
+    }
+    if (journal.is_open()) {
+        journal.record(JournalOp::AddFibre, {xpoint1.x, xpoint1.y, xpoint2.x, xpoint2.y, cost}, {});
+    }
+    return true;
+}
+
+// Palauttaa listan koordinaatteja, joihin annetusta koordinaatista menee suoraan kuituja, ja ko. kuidun hinnan.
+// Lista on järjestetty koordinaattien mukaiseen järjestykseen. Jos annetusta pisteestä ei lähde kuituja, palautetaan tyhjä lista.
+std::vector<std::pair<Coord, Cost>> Datastructures::get_fibres_from(Coord xpoint)
+{
+    std::vector<std::pair<Coord, Cost>> coords = {};
+
+    if (allFibres.find(xpoint) != allFibres.end()) {
+
+        std::for_each(allFibres.at(xpoint).fibres.begin(), allFibres.at(xpoint).fibres.end(),
+                      [&](const std::pair<Coord, Cost> &p){coords.push_back(p);});
+
+    }
+    return coords;
+}
+
+// Palauttaa listan kaikista kuiduista. Listassa jokainen kuitu ilmoitetaan sen päätepisteiden muodostamana koordinaattiparina niin,
+// että lista on järjestetty ensisijaisesti ensimmäisen koordinaatin mukaan, toissijaisesti toisen.
+std::vector<std::pair<Coord, Coord>> Datastructures::all_fibres()
+{
+    std::vector<std::pair<Coord, Coord>> fibres = {};
+
+    for (auto pair : fibreCoords) {
+        fibres.push_back(pair.first);
+    }
+    return fibres;
+}
+
+// Poistaa kuidun annettujen koordinaattien väliltä. Jos koordinaattien välillä ei ollut kuitua,
+// palautetaan false, muuten true.
+bool Datastructures::remove_fibre(Coord xpoint1, Coord xpoint2)
+{    
+    std::pair<Coord, Coord> points = swapCoords(std::make_pair(xpoint1, xpoint2));
+
+    if (fibreCoords.find(points) == fibreCoords.end() ) {
+        return false;
+    }
+
+    fibreCoords.erase(points);
+    if (snapshotsEnabled) {
+        currentVersion.fibres = currentVersion.fibres.erase(points).erase({points.second, points.first});
+        ++currentVersion.versionNumber;
+    }
+    if (journal.is_open()) {
+        journal.record(JournalOp::RemoveFibre, {xpoint1.x, xpoint1.y, xpoint2.x, xpoint2.y}, {});
+    }
+
+    if (allFibres.find(xpoint1) != allFibres.end()) {
+        allFibres.at(xpoint1).fibres.erase(xpoint2);
+        if (allFibres.at(xpoint1).fibres.empty()) {
+            allFibres.erase(xpoint1);
+        }
+    }
+
+    if (allFibres.find(xpoint2) != allFibres.end()) {
+        allFibres.at(xpoint2).fibres.erase(xpoint1);
+        if (allFibres.at(xpoint2).fibres.empty()) {
+            allFibres.erase(xpoint2);
+        }
+    }
+
+    return true;
+}
+
+//Tallentaa kaikki majakat, säteet ja kuidut binääritiedostoon. Palauttaa false, jos kirjoitus epäonnistui.
+bool Datastructures::save_snapshot(std::string const& filename)
+{
+    std::vector<SavedBeacon> saved(beacons.ids.size());
+    std::string strings = {};
+    for (std::uint32_t d = 0; d < beacons.ids.size(); ++d) {
+        SavedBeacon& record = saved[d];
+        record.idOffset = strings.size();
+        record.idLength = static_cast<std::uint32_t>(beacons.ids[d].size());
+        strings.append(beacons.ids[d]);
+        record.nameOffset = strings.size();
+        record.nameLength = static_cast<std::uint32_t>(beacons.names[d].size());
+        strings.append(beacons.names[d]);
+        record.x = beacons.coords[d].x;
+        record.y = beacons.coords[d].y;
+        record.r = beacons.colors[d].r;
+        record.g = beacons.colors[d].g;
+        record.b = beacons.colors[d].b;
+        record.target = beacons.sending[d] == NO_HANDLE ? NO_HANDLE : dense_index(beacons.sending[d]);
+    }
+    std::vector<SavedFibre> fibres = {};
+    fibres.reserve(fibreCoords.size());
+    for (auto const& fibre : fibreCoords) {
+        fibres.push_back({fibre.first.first.x, fibre.first.first.y, fibre.first.second.x, fibre.first.second.y,
+                          fibre.second});
+    }
+
+    SnapshotHeader header = {};
+    std::copy(std::begin(SNAPSHOT_MAGIC), std::end(SNAPSHOT_MAGIC), header.magic);
+    header.version = SNAPSHOT_VERSION;
+    header.beaconCount = saved.size();
+    header.fibreCount = fibres.size();
+    header.stringBytes = strings.size();
+    header.journalSequence = journal.last_sequence();
+    char const* beaconBytes = reinterpret_cast<char const*>(saved.data());
+    char const* fibreBytes = reinterpret_cast<char const*>(fibres.data());
+    header.checksum = fnv1a(beaconBytes, saved.size() * sizeof(SavedBeacon));
+    header.checksum = fnv1a(fibreBytes, fibres.size() * sizeof(SavedFibre), header.checksum);
+    header.checksum = fnv1a(strings.data(), strings.size(), header.checksum);
+
+    std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<char const*>(&header), sizeof(header));
+    file.write(beaconBytes, saved.size() * sizeof(SavedBeacon));
+    file.write(fibreBytes, fibres.size() * sizeof(SavedFibre));
+    file.write(strings.data(), strings.size());
+    file.close();
+    return !file.fail();
+}
+
+//Palauttaa jokaisen majakan kokonaisvärin, pisimmän tulevan ketjun pituuden ja nielun sarakkeina. Rivit ovat
+//majakoiden tallennusjärjestyksessä.
+ForestReport Datastructures::forest_report()
+{
+    ForestReport report;
+    std::size_t count = beacons.ids.size();
+    report.ids.reserve(count);
+    report.totalColors.assign(beacons.totalColors.begin(), beacons.totalColors.end());
+    report.inbeamLengths.assign(beacons.inbeamHeights.begin(), beacons.inbeamHeights.end());
+    report.sinkRows = sink_indices();
+    for (auto const& id : beacons.ids) {
+        report.ids.emplace_back(id);
+    }
+    return report;
+}
+
+//Kirjoittaa forest_reportin rivit tiedostoon pilkuilla eroteltuina otsikkorivin kanssa. Palauttaa false,
+//jos kirjoitus epäonnistuu.
+bool Datastructures::save_forest_report(std::string const& filename)
+{
+    std::vector<std::uint32_t> sinks = sink_indices();
+    std::ofstream file(filename, std::ios::trunc);
+    file << "id,r,g,b,inbeam_length,sink\n";
+    for (std::uint32_t d = 0; d < beacons.ids.size(); ++d) {
+        Color const& total = beacons.totalColors[d];
+        file << beacons.ids[d] << ',' << total.r << ',' << total.g << ',' << total.b << ','
+             << beacons.inbeamHeights[d] << ',' << beacons.ids[sinks[d]] << '\n';
+    }
+    file.close();
+    return !file.fail();
+}
+
+// Ketjua kuljetaan, kunnes vastaan tulee majakka, jonka nielu tiedetään, ja kuljettu osa saa saman nielun.
+// Muistina käytetään tavallista keosta varaamista, jotta funktio voidaan kutsua jaetun lukon alla.
+std::vector<std::uint32_t> Datastructures::sink_indices() const
+{
+    std::uint32_t const unknown = std::numeric_limits<std::uint32_t>::max();
+    std::vector<std::uint32_t> sinks(beacons.ids.size(), unknown);
+    std::vector<std::uint32_t> path;
+    for (std::uint32_t d = 0; d < beacons.ids.size(); ++d) {
+        std::uint32_t current = d;
+        path.clear();
+        while (sinks[current] == unknown and beacons.sending[current] != NO_HANDLE) {
+            path.push_back(current);
+            current = dense_index(beacons.sending[current]);
+        }
+        std::uint32_t sink = sinks[current] == unknown ? current : sinks[current];
+        sinks[current] = sink;
+        for (auto walked : path) {
+            sinks[walked] = sink;
+        }
+    }
+    return sinks;
+}
+
+//Korvaa kaikki majakat, säteet ja kuidut tiedoston sisällöllä. Tiedoston koko, versio, tarkistussumma,
+//viittaukset ja id:iden yksikäsitteisyys tarkistetaan ennen kuin mitään muutetaan; jos jokin ei täsmää,
+//palautetaan false ja tiedot säilyvät ennallaan.
+//Id:t ja nimet luetaan suoraan tiedoston muistista massalisäyksen kautta. Avoimen päiväkirjan aikana lataus
+//evätään, koska ladattua tilaa ei voisi palauttaa päiväkirjasta.
+bool Datastructures::load_snapshot(std::string const& filename)
+{
+    if (journal.is_open()) {
+        return false;
+    }
+    FileView file(filename);
+    SnapshotHeader header = {};
+    if (file.size() < sizeof(header)) {
+        return false;
+    }
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (!std::equal(std::begin(SNAPSHOT_MAGIC), std::end(SNAPSHOT_MAGIC), header.magic) or
+        header.version != SNAPSHOT_VERSION or header.beaconCount >= NO_HANDLE) {
+        return false;
+    }
+    std::size_t payload = file.size() - sizeof(header);
+    if (header.beaconCount > payload / sizeof(SavedBeacon) or
+        header.fibreCount > payload / sizeof(SavedFibre) or
+        header.beaconCount * sizeof(SavedBeacon) + header.fibreCount * sizeof(SavedFibre) + header.stringBytes
+            != payload) {
+        return false;
+    }
+    char const* beaconBytes = file.data() + sizeof(header);
+    char const* fibreBytes = beaconBytes + header.beaconCount * sizeof(SavedBeacon);
+    char const* strings = fibreBytes + header.fibreCount * sizeof(SavedFibre);
+    if (fnv1a(beaconBytes, payload) != header.checksum) {
+        return false;
+    }
+
+    auto saved_beacon = [&](std::size_t i) {
+        SavedBeacon record;
+        std::memcpy(&record, beaconBytes + i * sizeof(SavedBeacon), sizeof(record));
+        return record;
+    };
+    std::unordered_set<std::string_view> savedIds;
+    savedIds.reserve(header.beaconCount);
+    for (std::size_t i = 0; i < header.beaconCount; ++i) {
+        SavedBeacon record = saved_beacon(i);
+        if (record.idOffset > header.stringBytes or record.idLength > header.stringBytes - record.idOffset or
+            record.nameOffset > header.stringBytes or record.nameLength > header.stringBytes - record.nameOffset or
+            (record.target != NO_HANDLE and record.target >= header.beaconCount)) {
+            return false;
+        }
+        // Tarkistussumma voi täsmätä, vaikka tiedoston kirjoittaja olisi ollut viallinen
+        if (!savedIds.insert(std::string_view(strings + record.idOffset, record.idLength)).second) {
+            return false;
+        }
+    }
+    // Säteet eivät saa muodostaa silmukkaa: jokainen ketju kuljetaan kerran, ja jos kulku osuu
+    // samalla kulkukerralla jo käytyyn majakkaan, tiedostossa on silmukka
+    std::vector<std::uint32_t> walkedOn(header.beaconCount, 0);
+    for (std::uint32_t i = 0; i < header.beaconCount; ++i) {
+        std::uint32_t current = i;
+        while (current != NO_HANDLE and walkedOn[current] == 0) {
+            walkedOn[current] = i + 1;
+            current = saved_beacon(current).target;
+        }
+        if (current != NO_HANDLE and walkedOn[current] == i + 1) {
+            return false;
+        }
+    }
+
+    clear_beacons();
+    clear_fibres();
+    reserve_beacons(header.beaconCount);
+    std::pmr::monotonic_buffer_resource scratch(&beaconMemory);
+    std::pmr::vector<BeaconHandle> added(&scratch);
+    added.reserve(header.beaconCount);
+    for (std::size_t i = 0; i < header.beaconCount; ++i) {
+        SavedBeacon record = saved_beacon(i);
+        std::string_view id(strings + record.idOffset, record.idLength);
+        std::string_view name(strings + record.nameOffset, record.nameLength);
+        added.push_back(append_beacon(id, name, {record.x, record.y}, {record.r, record.g, record.b}));
+        add_name_trigrams(added.back(), name);
+    }
+
+    std::pmr::vector<std::pair<BeaconHandle, BeaconHandle>> beams(&scratch);
+    for (std::size_t i = 0; i < header.beaconCount; ++i) {
+        SavedBeacon record = saved_beacon(i);
+        if (record.target != NO_HANDLE) {
+            beams.push_back({added[i], added[record.target]});
+            // Kaikki majakat ovat vielä omissa puissaan, joten linkki-leikkauspuun kaaret asetetaan suoraan
+            beamTree.attach(added[i], added[record.target]);
+        }
+    }
+    link_new_beams(beams);
+    index_new_beacons(added);
+
+    for (std::size_t i = 0; i < header.fibreCount; ++i) {
+        SavedFibre fibre;
+        std::memcpy(&fibre, fibreBytes + i * sizeof(SavedFibre), sizeof(fibre));
+        add_fibre({fibre.x1, fibre.y1}, {fibre.x2, fibre.y2}, fibre.cost);
+    }
+    journal.set_last_sequence(header.journalSequence);
+    return true;
+}
+
+//Avaa uuden päiväkirjan (vanha sisältö hävitetään). Järjestysnumerot jatkuvat nykyisestä, joten päiväkirja
+//sopii yhteen viimeksi ladatun tai tallennetun tilannevedoksen kanssa.
+bool Datastructures::open_journal(std::string const& filename, JournalSync sync, std::size_t groupSize)
+{
+    return journal.open(filename, sync, groupSize, true);
+}
+
+bool Datastructures::sync_journal()
+{
+    return journal.flush(true);
+}
+
+void Datastructures::close_journal()
+{
+    journal.close();
+}
+
+//Tallentaa tilannevedoksen väliaikaiseen tiedostoon, synkronoi sen ja nimeää sen oikeaksi, jolloin vanha
+//tilannevedos korvautuu kerralla. Vasta sitten päiväkirja tyhjennetään; jos ohjelma kaatuu välissä,
+//palautus ohittaa päiväkirjan tietueet, jotka sisältyvät jo tilannevedokseen.
+bool Datastructures::checkpoint(std::string const& snapshotFile)
+{
+    if (!journal.flush(true)) {
+        return false;
+    }
+    std::string temporary = snapshotFile + ".tmp";
+    if (!save_snapshot(temporary) or !sync_file(temporary)) {
+        return false;
+    }
+#ifndef __unix__
+    std::remove(snapshotFile.c_str());
+#endif
+    if (std::rename(temporary.c_str(), snapshotFile.c_str()) != 0 or !sync_file(snapshotFile)) {
+        return false;
+    }
+    return !journal.is_open() or journal.restart();
+}
+
+//Lataa tilannevedoksen (jos tiedosto on olemassa) ja suorittaa päiväkirjasta tietueet, joiden järjestysnumero
+//on tilannevedoksen numeroa suurempi. Lukeminen lopetetaan ensimmäiseen vialliseen tietueeseen, ja tiedosto
+//katkaistaan siihen, jotta uudet tietueet tulevat ehjien perään. Lopuksi päiväkirja avataan jatkamaan.
+//Palauttaa false, jos tilannevedos on viallinen tai päiväkirjasta puuttuu tietueita tilannevedoksen jälkeen.
+bool Datastructures::recover(std::string const& snapshotFile, std::string const& journalFile,
+                             JournalSync sync, std::size_t groupSize)
+{
+    journal.close();
+    if (file_exists(snapshotFile)) {
+        if (!load_snapshot(snapshotFile)) {
+            return false;
+        }
+    }
+    else {
+        clear_beacons();
+        clear_fibres();
+        journal.set_last_sequence(0);
+    }
+
+    std::uint64_t expected = journal.last_sequence() + 1;
+    bool complete = true;
+    std::size_t validEnd = 0;
+    std::size_t fileSize = 0;
+    {
+        FileView file(journalFile);
+        fileSize = file.size();
+        validEnd = read_journal(file.data(), file.size(), [&](JournalEntry const& entry) {
+            if (entry.sequence < expected) {
+                return true;
+            }
+            if (entry.sequence != expected) {
+                complete = false;
+                return false;
+            }
+            apply_journal_entry(*this, entry);
+            ++expected;
+            return true;
+        });
+    }
+    if (!complete) {
+        return false;
+    }
+    journal.set_last_sequence(expected - 1);
+    if (validEnd == 0) {
+        return journal.open(journalFile, sync, groupSize, true);
+    }
+    if (validEnd != fileSize) {
+#ifdef __unix__
+        if (::truncate(journalFile.c_str(), static_cast<off_t>(validEnd)) != 0) {
+            return false;
+        }
+#else
+        std::string prefix;
+        {
+            FileView file(journalFile);
+            prefix.assign(file.data(), validEnd);
+        }
+        std::ofstream rewritten(journalFile, std::ios::binary | std::ios::trunc);
+        rewritten.write(prefix.data(), prefix.size());
+        rewritten.close();
+        if (rewritten.fail()) {
+            return false;
+        }
+#endif
+    }
+    return journal.open(journalFile, sync, groupSize, false);
+}
+
+// Mappeja ei tyhjennetä alkio kerrallaan, vaan niiden tilalle rakennetaan tyhjät mapit ja vanha muisti
+// vapautetaan poolista kerralla.
+void Datastructures::clear_fibres()
+{
+    recreate(fibreCoords, &fibreMemory);
+    recreate(allFibres, &fibreMemory);
+    fibrePool.release();
+    fibreMemory.reset_in_use();
+    currentVersion.fibres = {};
+    ++currentVersion.versionNumber;
+    if (journal.is_open()) {
+        journal.record(JournalOp::ClearFibres, {}, {});
+    }
+}
+
+// Leveyshaun tila (jono ja käydyt pisteet) on paikallinen, joten rinnakkaiset haut eivät häiritse toisiaan.
+// Jos reittiä ei löydy, palautetaan tyhjä vektori.
+std::vector<Coord> Datastructures::bfsRoute(Coord from, Coord to)
+{
+    // Reitit tarvitaan vain haun ajan, joten ne varataan paikallisesta areenasta, joka vapautetaan kerralla
+    std::pmr::monotonic_buffer_resource arena(std::pmr::new_delete_resource());
+    std::pmr::list<std::pmr::vector<Coord>> queue(&arena);
+    std::pmr::set<Coord> visited(&arena);
+    std::pmr::vector<Coord> route(&arena);
+    route.push_back(from);
+    queue.push_back(route);
+    visited.insert(from);
+
+    while (!queue.empty()) {
+        route = queue.front();
+        queue.pop_front();
         Coord last = route[route.size() -1];
 
         if (last == to) {
-            return route;
+            return std::vector<Coord>(route.begin(), route.end());
         }
 
-        for (auto i : allFibres.at(last).fibres) {
+        for (auto const& i : allFibres.at(last).fibres) {
 
-            if (allFibres.at(i.first).visited != true) {
-                std::vector<Coord> newpath(route);
+            if (visited.insert(i.first).second) {
+                std::pmr::vector<Coord> newpath(route, &arena);
                 newpath.push_back(i.first);
                 queue.push_back(newpath);
-                allFibres.at(i.first).visited = true;
             }
         }
     }
-    return route;
+    return {};
 }
 // Palauttaa jonkin (mielivaltaisen) reitin annettujen pisteiden välillä.
 // Palautetussa vektorissa on ensimmäisenä alkupiste hinnalla 0, sitten kaikki reitin varrella olevat pisteet ja
@@ -506,3 +3783,465 @@ Cost Datastructures::trim_fibre_network()
     // Replace this with your implementation
     return NO_COST;
 }
+
+// Lukevat kyselyt ajetaan jaetun lukon alla. Ne eivät muuta tietorakenteen tilaa eivätkä käytä sen
+// muistipooleja, joten niitä voi ajaa rinnakkain.
+
+int ConcurrentDatastructures::beacon_count()
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return ds.beacon_count();
+}
+
+std::vector<BeaconID> ConcurrentDatastructures::all_beacons()
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return ds.all_beacons();
+}
+
+std::string ConcurrentDatastructures::get_name(BeaconID id)
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return ds.get_name(id);
+}
+
+Coord ConcurrentDatastructures::get_coordinates(BeaconID id)
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return ds.get_coordinates(id);
+}
+
+Color ConcurrentDatastructures::get_color(BeaconID id)
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return ds.get_color(id);
+}
+
+std::vector<BeaconID> ConcurrentDatastructures::beacons_alphabetically()
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return ds.beacons_alphabetically();
+}
+
+std::vector<BeaconID> ConcurrentDatastructures::beacons_brightness_increasing()
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return ds.beacons_brightness_increasing();
+}
+
+BeaconID ConcurrentDatastructures::min_brightness()
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return ds.min_brightness();
+}
+
+BeaconID ConcurrentDatastructures::max_brightness()
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return ds.max_brightness();
+}
+
+int ConcurrentDatastructures::brightness_rank(BeaconID id)
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return ds.brightness_rank(id);
+}
+
+BeaconID ConcurrentDatastructures::kth_brightest(int k)
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return ds.kth_brightest(k);
+}
+
+std::vector<BeaconID> ConcurrentDatastructures::brightest_beacons(int count, int offset)
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return ds.brightest_beacons(count, offset);
+}
+
+std::vector<BeaconID> ConcurrentDatastructures::beacons_in_brightness_range(int lo, int hi, int offset, int limit)
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return ds.beacons_in_brightness_range(lo, hi, offset, limit);
+}
+
+std::vector<BeaconID> ConcurrentDatastructures::find_beacons(std::string const& name)
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return ds.find_beacons(name);
+}
+
+std::vector<BeaconID> ConcurrentDatastructures::find_beacons_prefix(std::string const& prefix)
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return ds.find_beacons_prefix(prefix);
+}
+
+std::vector<BeaconID> ConcurrentDatastructures::find_beacons_substring(std::string const& part)
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return ds.find_beacons_substring(part);
+}
+
+std::vector<BeaconID> ConcurrentDatastructures::get_lightsources(BeaconID id)
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return ds.get_lightsources(id);
+}
+
+std::vector<BeaconID> ConcurrentDatastructures::path_outbeam(BeaconID id)
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return ds.path_outbeam(id);
+}
+
+std::vector<BeaconID> ConcurrentDatastructures::path_inbeam_longest(BeaconID id)
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return ds.path_inbeam_longest(id);
+}
+
+Color ConcurrentDatastructures::total_color(BeaconID id)
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return ds.total_color(id);
+}
+
+std::vector<BeaconID> ConcurrentDatastructures::beacons_in_rect(Coord min, Coord max)
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return ds.beacons_in_rect(min, max);
+}
+
+int ConcurrentDatastructures::count_in_rect(Coord min, Coord max)
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return ds.count_in_rect(min, max);
+}
+
+std::vector<BeaconID> ConcurrentDatastructures::nearest_beacons(Coord xy, int k)
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return ds.nearest_beacons(xy, k);
+}
+
+void ConcurrentDatastructures::visit_all_beacons(std::function<bool(std::string_view)> const& visit)
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    ds.visit_all_beacons(visit);
+}
+
+void ConcurrentDatastructures::visit_beacons_alphabetically(std::function<bool(std::string_view)> const& visit)
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    ds.visit_beacons_alphabetically(visit);
+}
+
+void ConcurrentDatastructures::visit_beacons_brightness_increasing(std::function<bool(std::string_view)> const& visit)
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    ds.visit_beacons_brightness_increasing(visit);
+}
+
+BeaconRef ConcurrentDatastructures::beacon_ref(BeaconID id)
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return ds.beacon_ref(id);
+}
+
+bool ConcurrentDatastructures::is_valid(BeaconRef ref)
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return ds.is_valid(ref);
+}
+
+BeaconID ConcurrentDatastructures::get_id(BeaconRef ref)
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return ds.get_id(ref);
+}
+
+std::string ConcurrentDatastructures::get_name(BeaconRef ref)
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return ds.get_name(ref);
+}
+
+Coord ConcurrentDatastructures::get_coordinates(BeaconRef ref)
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return ds.get_coordinates(ref);
+}
+
+Color ConcurrentDatastructures::get_color(BeaconRef ref)
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return ds.get_color(ref);
+}
+
+AllocationStats ConcurrentDatastructures::beacon_allocation_stats()
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return ds.beacon_allocation_stats();
+}
+
+AllocationStats ConcurrentDatastructures::fibre_allocation_stats()
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return ds.fibre_allocation_stats();
+}
+
+std::vector<Coord> ConcurrentDatastructures::all_xpoints()
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return ds.all_xpoints();
+}
+
+std::vector<std::pair<Coord, Cost>> ConcurrentDatastructures::get_fibres_from(Coord xpoint)
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return ds.get_fibres_from(xpoint);
+}
+
+std::vector<std::pair<Coord, Coord>> ConcurrentDatastructures::all_fibres()
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return ds.all_fibres();
+}
+
+std::vector<std::pair<Coord, Cost>> ConcurrentDatastructures::route_any(Coord fromxpoint, Coord toxpoint)
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return ds.route_any(fromxpoint, toxpoint);
+}
+
+std::vector<std::pair<Coord, Cost>> ConcurrentDatastructures::route_least_xpoints(Coord fromxpoint, Coord toxpoint)
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return ds.route_least_xpoints(fromxpoint, toxpoint);
+}
+
+std::vector<std::pair<Coord, Cost>> ConcurrentDatastructures::route_fastest(Coord fromxpoint, Coord toxpoint)
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return ds.route_fastest(fromxpoint, toxpoint);
+}
+
+std::vector<Coord> ConcurrentDatastructures::route_fibre_cycle(Coord startxpoint)
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return ds.route_fibre_cycle(startxpoint);
+}
+
+std::shared_ptr<DataSnapshot const> ConcurrentDatastructures::snapshot()
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return ds.snapshot();
+}
+
+bool ConcurrentDatastructures::save_snapshot(std::string const& filename)
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return ds.save_snapshot(filename);
+}
+
+// Muokkaavat operaatiot ajetaan yksinoikeudellisen lukon alla yksi kerrallaan.
+
+void ConcurrentDatastructures::clear_beacons()
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    ds.clear_beacons();
+}
+
+bool ConcurrentDatastructures::add_beacon(BeaconID id, std::string const& name, Coord xy, Color color)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    return ds.add_beacon(id, name, xy, color);
+}
+
+bool ConcurrentDatastructures::change_beacon_name(BeaconID id, std::string const& newname)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    return ds.change_beacon_name(id, newname);
+}
+
+bool ConcurrentDatastructures::change_beacon_color(BeaconID id, Color newcolor)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    return ds.change_beacon_color(id, newcolor);
+}
+
+bool ConcurrentDatastructures::add_lightbeam(BeaconID sourceid, BeaconID targetid)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    return ds.add_lightbeam(sourceid, targetid);
+}
+
+bool ConcurrentDatastructures::remove_beacon(BeaconID id)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    return ds.remove_beacon(id);
+}
+
+int ConcurrentDatastructures::add_beacons(std::vector<BeaconSpec> const& specs)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    return ds.add_beacons(specs);
+}
+
+int ConcurrentDatastructures::add_lightbeams(std::vector<std::pair<BeaconID, BeaconID>> const& beams)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    return ds.add_lightbeams(beams);
+}
+
+bool ConcurrentDatastructures::add_fibre(Coord xpoint1, Coord xpoint2, Cost cost)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    return ds.add_fibre(xpoint1, xpoint2, cost);
+}
+
+bool ConcurrentDatastructures::remove_fibre(Coord xpoint1, Coord xpoint2)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    return ds.remove_fibre(xpoint1, xpoint2);
+}
+
+void ConcurrentDatastructures::clear_fibres()
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    ds.clear_fibres();
+}
+
+Cost ConcurrentDatastructures::trim_fibre_network()
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    return ds.trim_fibre_network();
+}
+
+void ConcurrentDatastructures::enable_snapshots(bool enabled)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    ds.enable_snapshots(enabled);
+}
+
+bool ConcurrentDatastructures::load_snapshot(std::string const& filename)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    return ds.load_snapshot(filename);
+}
+
+bool ConcurrentDatastructures::open_journal(std::string const& filename, JournalSync sync, std::size_t groupSize)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    return ds.open_journal(filename, sync, groupSize);
+}
+
+bool ConcurrentDatastructures::sync_journal()
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    return ds.sync_journal();
+}
+
+void ConcurrentDatastructures::close_journal()
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    ds.close_journal();
+}
+
+bool ConcurrentDatastructures::checkpoint(std::string const& snapshotFile)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    return ds.checkpoint(snapshotFile);
+}
+
+bool ConcurrentDatastructures::recover(std::string const& snapshotFile, std::string const& journalFile,
+                                       JournalSync sync, std::size_t groupSize)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    return ds.recover(snapshotFile, journalFile, sync, groupSize);
+}
+
+void ConcurrentDatastructures::enable_beam_tree(bool enabled)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    ds.enable_beam_tree(enabled);
+}
+
+BeaconID ConcurrentDatastructures::find_sink(BeaconID id)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    return ds.find_sink(id);
+}
+
+int ConcurrentDatastructures::outbeam_length(BeaconID id)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    return ds.outbeam_length(id);
+}
+
+BeaconID ConcurrentDatastructures::brightest_on_outbeam(BeaconID id)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    return ds.brightest_on_outbeam(id);
+}
+
+void ConcurrentDatastructures::set_evaluator_threads(unsigned threads)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    ds.set_evaluator_threads(threads);
+}
+
+ForestReport ConcurrentDatastructures::forest_report()
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return ds.forest_report();
+}
+
+bool ConcurrentDatastructures::save_forest_report(std::string const& filename)
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return ds.save_forest_report(filename);
+}
+
+BeaconID ConcurrentDatastructures::dimmest_on_outbeam(BeaconID id)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    return ds.dimmest_on_outbeam(id);
+}
+
+std::int64_t ConcurrentDatastructures::outbeam_brightness_sum(BeaconID id)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    return ds.outbeam_brightness_sum(id);
+}
+
+BeaconID ConcurrentDatastructures::kth_downstream(BeaconID id, int k)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    return ds.kth_downstream(id, k);
+}
+
+BeaconID ConcurrentDatastructures::first_common_receiver(BeaconID id1, BeaconID id2)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    return ds.first_common_receiver(id1, id2);
+}
+
+bool ConcurrentDatastructures::is_upstream(BeaconID id1, BeaconID id2)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    return ds.is_upstream(id1, id2);
+}
+
+int ConcurrentDatastructures::inbeam_tree_size(BeaconID id)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    return ds.inbeam_tree_size(id);
+}
+
+Color ConcurrentDatastructures::inbeam_tree_color_sum(BeaconID id)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    return ds.inbeam_tree_color_sum(id);
+}
@@ -9,8 +9,17 @@
 #include <limits>
 #include <unordered_map>
 #include <map>
+#include <set>
 #include <memory>
 #include <list>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory_resource>
+#include <string_view>
+#include <shared_mutex>
+#include <cstdio>
+#include <initializer_list>
 
 // Type for beacon IDs
 using BeaconID = std::string;
@@ -81,23 +90,747 @@ using Cost = int;
 // Return value for cases where cost is unknown
 Cost const NO_COST = NO_VALUE;
 
-struct Beacon {
+// Type for internal beacon handles (index to the slot table, stays the same while the beacon exists)
+using BeaconHandle = std::uint32_t;
 
+// Handle value for cases where beacon does not exist (or does not send light)
+BeaconHandle const NO_HANDLE = std::numeric_limits<BeaconHandle>::max();
+
+// Generation-checked beacon handle for users of the class. If the beacon is removed
+// the generation of its slot changes, so an old BeaconRef can be detected as stale.
+struct BeaconRef
+{
+    BeaconHandle handle = NO_HANDLE;
+    std::uint32_t generation = 0;
+};
+
+inline bool operator==(BeaconRef r1, BeaconRef r2) { return r1.handle == r2.handle && r1.generation == r2.generation; }
+inline bool operator!=(BeaconRef r1, BeaconRef r2) { return !(r1==r2); }
+
+// Return value for cases where beacon was not found
+BeaconRef const NO_REF = {NO_HANDLE, 0};
+
+// Slot of the slot map: position of the beacon in the dense columns and the slot's generation
+struct BeaconSlot {
+
+    std::uint32_t dense = NO_HANDLE;
+    std::uint32_t generation = 0;
+};
+
+// Beacon data for adding many beacons at once with add_beacons
+struct BeaconSpec
+{
     BeaconID id = NO_ID;
-    Coord coord = NO_COORD;
     std::string name = NO_NAME;
+    Coord xy = NO_COORD;
     Color color = NO_COLOR;
-    std::shared_ptr<Beacon> sending = nullptr;
-    std::vector<std::shared_ptr<Beacon>> receiving = {};
-    int brightness = 0;
+};
+
+// Results of forest_report as columns, one row per beacon in the same order in every column
+struct ForestReport
+{
+    std::vector<BeaconID> ids;
+    std::vector<Color> totalColors;
+    // Length of path_inbeam_longest, the beacon itself included
+    std::vector<int> inbeamLengths;
+    // Row of the sink of the beacon's outbeam, the beacon's own row if it sends no light
+    std::vector<std::uint32_t> sinkRows;
+};
+
+// Order statistic tree (treap) for arranging beacons by brightness. The nodes are kept in a vector
+// indexed by beacon handle, so the node of a beacon is found without searching. Keys are
+// (brightness, handle) pairs, so every key is unique. Used for brightnesses of any range.
+class BrightnessTreap
+{
+public:
+    explicit BrightnessTreap(std::pmr::memory_resource* memory);
+
+    std::size_t size() const;
+    bool empty() const;
+    void insert(BeaconHandle handle, int brightness);
+    void erase(BeaconHandle handle);
+
+    // Builds the whole tree at once from (brightness, handle) keys in increasing order.
+    // The index must be empty.
+    void build_sorted(std::pmr::vector<std::pair<int, BeaconHandle>> const& keys);
+
+    // Number of keys smaller than (brightness, handle)
+    std::size_t order_of_key(int brightness, BeaconHandle handle) const;
+
+    // Beacon that has k smaller keys, NO_HANDLE if k >= size()
+    BeaconHandle find_by_order(std::size_t k) const;
+
+    // In-order traversal, NO_HANDLE past the ends
+    BeaconHandle first() const;
+    BeaconHandle last() const;
+    BeaconHandle next(BeaconHandle handle) const;
+    BeaconHandle prev(BeaconHandle handle) const;
+
+private:
+    struct Node
+    {
+        BeaconHandle left = NO_HANDLE;
+        BeaconHandle right = NO_HANDLE;
+        BeaconHandle parent = NO_HANDLE;
+        std::uint32_t size = 0;
+        std::uint32_t priority = 0;
+        int brightness = 0;
+    };
+
+    bool less(BeaconHandle h1, BeaconHandle h2) const;
+    std::uint32_t subtree_size(BeaconHandle handle) const;
+    void rotate_up(BeaconHandle handle);
+
+    std::pmr::vector<Node> nodes;
+    BeaconHandle root = NO_HANDLE;
+};
+
+// Smallest and largest brightness 3*r+6*g+b of colors whose channels are in 0..255
+int const MIN_BUCKET_BRIGHTNESS = 0;
+int const MAX_BUCKET_BRIGHTNESS = 2550;
+
+// Brightness index for the bounded brightness range: one bucket (vector of handles) per brightness,
+// a two-level bitmap of non-empty buckets and a Fenwick tree of bucket sizes. Beacons of the same
+// brightness are in the order of their positions in the bucket; removal moves the last beacon of the
+// bucket into the freed position. Insert and erase are O(1), min, max and moving to the next non-empty
+// bucket are bit scans, and rank queries walk the Fenwick tree of the fixed 2551 buckets.
+class BrightnessBuckets
+{
+public:
+    explicit BrightnessBuckets(std::pmr::memory_resource* memory);
+
+    std::size_t size() const;
+    bool empty() const;
+    void insert(BeaconHandle handle, int brightness);
+    void erase(BeaconHandle handle);
+
+    // Number of beacons before the beacon in the index order
+    std::size_t rank(BeaconHandle handle) const;
+
+    // Number of beacons whose brightness is smaller than the given one
+    std::size_t count_below(int brightness) const;
+
+    // Beacon that has k beacons before it, NO_HANDLE if k >= size()
+    BeaconHandle find_by_order(std::size_t k) const;
+
+    // In-order traversal, NO_HANDLE past the ends
+    BeaconHandle first() const;
+    BeaconHandle last() const;
+    BeaconHandle next(BeaconHandle handle) const;
+    BeaconHandle prev(BeaconHandle handle) const;
+
+    // Appends all (brightness, handle) pairs in index order
+    void collect(std::pmr::vector<std::pair<int, BeaconHandle>>& keys) const;
+
+private:
+    static int const BUCKET_COUNT = MAX_BUCKET_BRIGHTNESS - MIN_BUCKET_BRIGHTNESS + 1;
+    static int const WORD_COUNT = (BUCKET_COUNT + 63) / 64;
+
+    struct Position
+    {
+        std::int32_t bucket = -1;
+        std::uint32_t index = 0;
+    };
+
+    // First non-empty bucket >= bucket and last non-empty bucket <= bucket, -1 if there is none
+    int next_bucket(int bucket) const;
+    int prev_bucket(int bucket) const;
+
+    // Number of beacons in buckets before the bucket
+    std::size_t prefix_count(int bucket) const;
+    void add_count(int bucket, int delta);
+
+    std::pmr::vector<std::pmr::vector<BeaconHandle>> buckets;
+    std::pmr::vector<Position> positions;
+    // Fenwick tree of bucket sizes, 1-based
+    std::pmr::vector<std::uint32_t> counts;
+    // Bit per non-empty bucket, and bit per non-zero word of bucketBits
+    std::uint64_t bucketBits[WORD_COUNT] = {};
+    std::uint64_t wordBits = 0;
+    std::size_t count = 0;
+};
+
+// Index for arranging beacons by brightness. While every brightness is in the bucket range the
+// constant-time BrightnessBuckets is used; the first brightness outside it moves all beacons into
+// a BrightnessTreap, which is used until the index is empty again. Both order the beacons by
+// brightness, ties are in a fixed order given by the structure in use.
+class BrightnessIndex
+{
+public:
+    explicit BrightnessIndex(std::pmr::memory_resource* memory);
+
+    std::size_t size() const;
+    bool empty() const;
+    void insert(BeaconHandle handle, int brightness);
+    void erase(BeaconHandle handle);
+
+    // Inserts many beacons at once as (brightness, handle) pairs, reorders the vector
+    void insert_all(std::pmr::vector<std::pair<int, BeaconHandle>>& keys);
+
+    // Number of beacons before the beacon (that has the given brightness) in the index order
+    std::size_t rank(BeaconHandle handle, int brightness) const;
+
+    // Number of beacons whose brightness is smaller than the given one
+    std::size_t count_below(int brightness) const;
+
+    // Beacon that has k beacons before it, NO_HANDLE if k >= size()
+    BeaconHandle find_by_order(std::size_t k) const;
+
+    // In-order traversal, NO_HANDLE past the ends
+    BeaconHandle first() const;
+    BeaconHandle last() const;
+    BeaconHandle next(BeaconHandle handle) const;
+    BeaconHandle prev(BeaconHandle handle) const;
+
+    // True while the bucket index is in use
+    bool uses_buckets() const;
+
+private:
+    // Moves all beacons from the buckets into the treap
+    void switch_to_treap();
+
+    std::pmr::memory_resource* memory;
+    BrightnessBuckets buckets;
+    BrightnessTreap treap;
+    bool bucketMode = true;
+};
+
+// Link-cut tree over the lightbeam forest. Every beacon is a node and the beacon it sends light to is
+// its parent, so the root of a tree is the sink of every outbeam in it. Each preferred path is kept in a
+// splay tree ordered by depth (the root end first), and the nodes are in a vector indexed by beacon
+// handle. Every splay tree node also keeps the brightest beacon of its subtree. Queries splay the trees,
+// so they modify the structure even though the forest itself stays the same.
+class BeamLinkCutTree
+{
+public:
+    explicit BeamLinkCutTree(std::pmr::memory_resource* memory);
+
+    // Makes the beacon a tree of its own with the given brightness
+    void reset(BeaconHandle handle, int brightness);
+
+    // Sets the parent of a node that is alone in its splay tree, used when the forest is built at once
+    void attach(BeaconHandle child, BeaconHandle parent);
+
+    // Links the root of a tree under target. The caller checks that target is not in the same tree.
+    void link(BeaconHandle root, BeaconHandle target);
+
+    // Cuts the node from its parent, so it becomes the root of its own tree
+    void cut(BeaconHandle handle);
+
+    void set_brightness(BeaconHandle handle, int brightness);
+
+    // Root of the node's tree
+    BeaconHandle find_root(BeaconHandle handle);
+
+    // Number of ancestors of the node
+    std::size_t depth(BeaconHandle handle);
+
+    // Brightest beacon on the path from the node to the root, on ties the one nearest to the node
+    BeaconHandle path_max(BeaconHandle handle);
+
+    // Dimmest beacon on the path from the node to the root, on ties the one nearest to the node
+    BeaconHandle path_min(BeaconHandle handle);
+
+    // Sum of the brightnesses on the path from the node to the root
+    std::int64_t path_sum(BeaconHandle handle);
+
+private:
+    struct Node
+    {
+        BeaconHandle left = NO_HANDLE;
+        BeaconHandle right = NO_HANDLE;
+        // Parent in the splay tree, or path-parent if the node is the root of its splay tree
+        BeaconHandle parent = NO_HANDLE;
+        std::uint32_t size = 1;
+        int brightness = 0;
+        // Brightest and dimmest node of the splay subtree, on ties the deepest one
+        BeaconHandle best = NO_HANDLE;
+        BeaconHandle worst = NO_HANDLE;
+        std::int64_t brightnessSum = 0;
+    };
+
+    bool is_splay_root(BeaconHandle handle) const;
+    void pull(BeaconHandle handle);
+    void rotate(BeaconHandle handle);
+    void splay(BeaconHandle handle);
+
+    // Makes the path from the root to the node preferred and splays the node to the root of its splay tree
+    void access(BeaconHandle handle);
+
+    std::pmr::vector<Node> nodes;
+};
+
+// Euler tour of the beam forest kept in splay trees, one splay tree per beam tree. Each beacon has an
+// opening and a closing token, and the sources of a beacon are toured between its tokens, so the inbeam
+// tree of a beacon is the part of the tour between them. Nodes are indexed by token: 2 * handle opens
+// and 2 * handle + 1 closes the beacon.
+class BeamEulerTour
+{
+public:
+    // Number of beacons and sum of their colors in a part of the tour
+    struct Totals
+    {
+        std::size_t beacons = 0;
+        std::int64_t r = 0;
+        std::int64_t g = 0;
+        std::int64_t b = 0;
+    };
+
+    explicit BeamEulerTour(std::pmr::memory_resource* memory);
+
+    // Makes the beacon a tour of its own with the given color
+    void reset(BeaconHandle handle, Color color);
+
+    // Builds a balanced splay tree from the tokens of one tree in tour order. The beacons must be reset.
+    void build(std::pmr::vector<std::uint32_t> const& tokens);
+
+    // Moves the tour of a root beacon right after the opening token of target
+    void link(BeaconHandle root, BeaconHandle target);
+
+    // Cuts the tokens of the beacon and its sources out of the tour, so it becomes the root of its own tree
+    void cut(BeaconHandle handle);
+
+    void set_color(BeaconHandle handle, Color color);
+
+    // True if the beacon is toured strictly between the tokens of ancestor
+    bool is_inside(BeaconHandle handle, BeaconHandle ancestor);
+
+    // Totals of the beacon and all beacons toured between its tokens
+    Totals inbeam_totals(BeaconHandle handle);
+
+private:
+    struct Node
+    {
+        std::uint32_t left = NO_HANDLE;
+        std::uint32_t right = NO_HANDLE;
+        std::uint32_t parent = NO_HANDLE;
+        // Tokens in the splay subtree, used as positions in the tour
+        std::uint32_t tokens = 1;
+        Color color = {0, 0, 0};
+        Totals totals;
+    };
+
+    void pull(std::uint32_t token);
+    void rotate(std::uint32_t token);
+    void splay(std::uint32_t token);
+
+    // Root of the token's splay tree before the token is splayed to the root
+    std::uint32_t root_of(std::uint32_t token);
+
+    // Joins two splay trees, all tokens of the first before the second, and returns the root
+    std::uint32_t join(std::uint32_t first, std::uint32_t second);
+
+    std::uint32_t build_range(std::pmr::vector<std::uint32_t> const& tokens, std::size_t begin,
+                              std::size_t end, std::uint32_t parent);
+
+    std::pmr::vector<Node> nodes;
+};
+
+// Allocation counters of a memory resource
+struct AllocationStats
+{
+    std::size_t allocations = 0;
+    std::size_t deallocations = 0;
+    std::size_t bytesInUse = 0;
+};
+
+// Memory resource that passes allocations on to its upstream resource and counts them
+class CountingResource : public std::pmr::memory_resource
+{
+public:
+    explicit CountingResource(std::pmr::memory_resource* upstream);
+
+    AllocationStats stats() const;
+
+    // Zeroes bytesInUse after the upstream resource has released all memory at once
+    void reset_in_use();
 
+private:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override;
+    void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override;
+    bool do_is_equal(std::pmr::memory_resource const& other) const noexcept override;
+
+    std::pmr::memory_resource* upstream;
+    AllocationStats counters;
+};
+
+// Beacons' data as structure of arrays, all columns are indexed by the same dense index.
+// Removing a beacon moves the last beacon into the freed position (swap and pop).
+struct BeaconColumns {
+
+    explicit BeaconColumns(std::pmr::memory_resource* memory);
+
+    // IDs point to characters interned in the memory resource of the columns
+    std::pmr::vector<std::string_view> ids;
+    std::pmr::vector<Coord> coords;
+    std::pmr::vector<std::pmr::string> names;
+    std::pmr::vector<Color> colors;
+    std::pmr::vector<int> brightnesses;
+    std::pmr::vector<BeaconHandle> sending;
+    std::pmr::vector<std::pmr::vector<BeaconHandle>> receiving;
+    // Position of the beacon in the receiving vector of the beacon it sends to
+    std::pmr::vector<std::uint32_t> receivingPos;
+    // Position of the beacon in the list of its grid cell
+    std::pmr::vector<std::uint32_t> gridPos;
+    // Cached total color and the sum of the total colors of the beacons in receiving
+    std::pmr::vector<Color> totalColors;
+    std::pmr::vector<Color> receivedSums;
+    // Number of beacons on the longest incoming chain (including the beacon itself)
+    // and the source that continues that chain
+    std::pmr::vector<int> inbeamHeights;
+    std::pmr::vector<BeaconHandle> longestSources;
+    // Number of sources that continue a longest incoming chain. They are kept at the front of receiving,
+    // and longestSources is the first of them.
+    std::pmr::vector<std::uint32_t> longestCounts;
+    std::pmr::vector<BeaconHandle> handles;
 };
 
 struct Xpoint {
 
     Coord coord = NO_COORD;
-    std::map<Coord, Cost> fibres = {};
-    bool visited = false;
+    std::pmr::map<Coord, Cost> fibres = {};
+};
+
+// Read-only range of beacon IDs as string_views. The IDs point into the data structure, so a view
+// is valid only until the next operation that adds, removes or changes beacons.
+template <typename Iterator>
+struct BeaconIdView
+{
+    Iterator first;
+    Iterator last;
+    std::size_t count = 0;
+
+    Iterator begin() const { return first; }
+    Iterator end() const { return last; }
+    std::size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+};
+
+// Persistent ordered map: a treap whose nodes are never modified after they are created. Every
+// modification copies only the path from the root to the changed node and returns a new map that
+// shares all other nodes with the old one, so copying a map is O(1) and old copies stay valid.
+// Nodes are reference counted and freed when the last map that uses them is destroyed.
+template <typename Key, typename Value>
+class PersistentMap
+{
+public:
+    std::size_t size() const { return subtree_size(root); }
+    bool empty() const { return root == nullptr; }
+
+    // Value of the key or nullptr if the key is not in the map
+    Value const* find(Key const& key) const
+    {
+        for (Node const* node = root.get(); node != nullptr;) {
+            if (key < node->key) {
+                node = node->left.get();
+            }
+            else if (node->key < key) {
+                node = node->right.get();
+            }
+            else {
+                return &node->value;
+            }
+        }
+        return nullptr;
+    }
+
+    // Map where the key has the given value (added or replaced)
+    PersistentMap insert(Key const& key, Value const& value) const
+    {
+        PersistentMap result = *this;
+        if (find(key) != nullptr) {
+            result.root = replace(root, key, value);
+        }
+        else {
+            ++result.seed;
+            result.root = insert(root, key, value, mix(result.seed));
+        }
+        return result;
+    }
+
+    // Map without the key
+    PersistentMap erase(Key const& key) const
+    {
+        PersistentMap result = *this;
+        if (find(key) != nullptr) {
+            result.root = erase(root, key);
+        }
+        return result;
+    }
+
+    // Visits the pairs with key >= first in key order, visit(key, value) returns false to stop
+    template <typename Visit>
+    void visit_from(Key const& first, Visit visit) const
+    {
+        std::vector<Node const*> stack;
+        for (Node const* node = root.get(); node != nullptr;) {
+            if (node->key < first) {
+                node = node->right.get();
+            }
+            else {
+                stack.push_back(node);
+                node = node->left.get();
+            }
+        }
+        visit_stack(stack, visit);
+    }
+
+    // Visits all pairs in key order, visit(key, value) returns false to stop
+    template <typename Visit>
+    void visit_all(Visit visit) const
+    {
+        std::vector<Node const*> stack;
+        for (Node const* node = root.get(); node != nullptr; node = node->left.get()) {
+            stack.push_back(node);
+        }
+        visit_stack(stack, visit);
+    }
+
+private:
+    struct Node;
+    using NodePtr = std::shared_ptr<Node const>;
+
+    struct Node
+    {
+        Key key;
+        Value value;
+        std::uint64_t priority;
+        std::size_t size;
+        NodePtr left;
+        NodePtr right;
+    };
+
+    static std::size_t subtree_size(NodePtr const& node) { return node ? node->size : 0; }
+
+    static NodePtr make(Key const& key, Value const& value, std::uint64_t priority, NodePtr left, NodePtr right)
+    {
+        std::size_t size = 1 + subtree_size(left) + subtree_size(right);
+        return std::make_shared<Node const>(Node{key, value, priority, size, std::move(left), std::move(right)});
+    }
+
+    static NodePtr with_children(NodePtr const& node, NodePtr left, NodePtr right)
+    {
+        return make(node->key, node->value, node->priority, std::move(left), std::move(right));
+    }
+
+    static std::uint64_t mix(std::uint64_t x)
+    {
+        x += 0x9e3779b97f4a7c15ull;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+        return x ^ (x >> 31);
+    }
+
+    // Splits the tree into keys smaller and greater than key (key itself is not in the tree)
+    static std::pair<NodePtr, NodePtr> split(NodePtr const& node, Key const& key)
+    {
+        if (!node) {
+            return {nullptr, nullptr};
+        }
+        if (node->key < key) {
+            auto parts = split(node->right, key);
+            return {with_children(node, node->left, std::move(parts.first)), std::move(parts.second)};
+        }
+        auto parts = split(node->left, key);
+        return {std::move(parts.first), with_children(node, std::move(parts.second), node->right)};
+    }
+
+    static NodePtr merge(NodePtr const& smaller, NodePtr const& greater)
+    {
+        if (!smaller) {
+            return greater;
+        }
+        if (!greater) {
+            return smaller;
+        }
+        if (smaller->priority > greater->priority) {
+            return with_children(smaller, smaller->left, merge(smaller->right, greater));
+        }
+        return with_children(greater, merge(smaller, greater->left), greater->right);
+    }
+
+    static NodePtr insert(NodePtr const& node, Key const& key, Value const& value, std::uint64_t priority)
+    {
+        if (!node or priority > node->priority) {
+            auto parts = split(node, key);
+            return make(key, value, priority, std::move(parts.first), std::move(parts.second));
+        }
+        if (key < node->key) {
+            return with_children(node, insert(node->left, key, value, priority), node->right);
+        }
+        return with_children(node, node->left, insert(node->right, key, value, priority));
+    }
+
+    static NodePtr replace(NodePtr const& node, Key const& key, Value const& value)
+    {
+        if (key < node->key) {
+            return with_children(node, replace(node->left, key, value), node->right);
+        }
+        if (node->key < key) {
+            return with_children(node, node->left, replace(node->right, key, value));
+        }
+        return make(key, value, node->priority, node->left, node->right);
+    }
+
+    static NodePtr erase(NodePtr const& node, Key const& key)
+    {
+        if (key < node->key) {
+            return with_children(node, erase(node->left, key), node->right);
+        }
+        if (node->key < key) {
+            return with_children(node, node->left, erase(node->right, key));
+        }
+        return merge(node->left, node->right);
+    }
+
+    template <typename Visit>
+    static void visit_stack(std::vector<Node const*>& stack, Visit& visit)
+    {
+        while (!stack.empty()) {
+            Node const* node = stack.back();
+            stack.pop_back();
+            if (!visit(node->key, node->value)) {
+                return;
+            }
+            for (Node const* next = node->right.get(); next != nullptr; next = next->left.get()) {
+                stack.push_back(next);
+            }
+        }
+    }
+
+    NodePtr root = nullptr;
+    std::uint64_t seed = 0;
+};
+
+// Beacon data stored in snapshots
+struct BeaconRecord
+{
+    std::string name = NO_NAME;
+    Coord xy = NO_COORD;
+    Color color = NO_COLOR;
+    // Beacon that this beacon sends light to, NO_ID if none
+    BeaconID target = NO_ID;
+};
+
+// Immutable version of the beacons and fibres returned by Datastructures::snapshot(). A snapshot can
+// be read without locks while the data structure keeps changing. Fibres are stored in both directions.
+class DataSnapshot
+{
+public:
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: versionumero on tallessa
+    std::uint64_t version() const;
+
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: puun koko on juuressa
+    int beacon_count() const;
+
+    // Estimate of performance: O(n)
+    // Short rationale for estimate: puu käydään läpi sisäjärjestyksessä, tulos on id:n mukaan järjestyksessä
+    std::vector<BeaconID> all_beacons() const;
+
+    // Estimate of performance: O(logn)
+    // Short rationale for estimate: haku puusta
+    BeaconRecord get_beacon(BeaconID const& id) const;
+
+    // Estimate of performance: O(klogn)
+    // Short rationale for estimate: jokainen ketjun k majakka haetaan puusta
+    std::vector<BeaconID> path_outbeam(BeaconID const& id) const;
+
+    // Estimate of performance: O(n)
+    // Short rationale for estimate: kuitupuu käydään läpi kerran
+    std::vector<Coord> all_xpoints() const;
+
+    // Estimate of performance: O(logn + k)
+    // Short rationale for estimate: haetaan pisteen ensimmäinen kuitu ja käydään sen k kuitua läpi
+    std::vector<std::pair<Coord, Cost>> get_fibres_from(Coord xpoint) const;
+
+    // Estimate of performance: O(n)
+    // Short rationale for estimate: kuitupuu käydään läpi kerran
+    std::vector<std::pair<Coord, Coord>> all_fibres() const;
+
+    // Estimate of performance: O((n + m)logn)
+    // Short rationale for estimate: leveyshaku, jokaisen pisteen kuidut haetaan puusta
+    std::vector<std::pair<Coord, Cost>> route_least_xpoints(Coord fromxpoint, Coord toxpoint) const;
+
+private:
+    friend class Datastructures;
+
+    std::uint64_t versionNumber = 0;
+    PersistentMap<BeaconID, BeaconRecord> beacons;
+    PersistentMap<std::pair<Coord, Coord>, Cost> fibres;
+};
+
+// When the journal forces its records to stable storage
+enum class JournalSync
+{
+    // Records are handed to the operating system when the buffer fills and on sync; never fsynced
+    None,
+    // Group commit: buffered records are written and fsynced together once groupSize records have collected
+    Group,
+    // Every record is written and fsynced before the modifying operation returns
+    Always
+};
+
+// Kinds of journal records, one for each modifying operation
+enum class JournalOp : std::uint32_t
+{
+    AddBeacon = 1,
+    ChangeName,
+    ChangeColor,
+    AddBeam,
+    RemoveBeacon,
+    ClearBeacons,
+    AddFibre,
+    RemoveFibre,
+    ClearFibres
+};
+
+// Append-only write-ahead journal of modifying operations. Records are encoded into a buffer and
+// written to the file in groups. Every record has a sequence number and a checksum, so recovery can
+// skip the records that a snapshot file already contains and stop at a torn record at the end of the file.
+// A failed write is remembered and reported by flush; the operations themselves can't report it.
+class Journal
+{
+public:
+    Journal() = default;
+    ~Journal();
+
+    Journal(Journal const&) = delete;
+    Journal& operator=(Journal const&) = delete;
+
+    // Opens the file for appending. With truncate the file is emptied and gets a new file header,
+    // otherwise it must already end at a whole record.
+    bool open(std::string const& filename, JournalSync sync, std::size_t groupSize, bool truncate);
+    bool is_open() const;
+
+    // Writes the buffered records to the file, and with durable also fsyncs them
+    bool flush(bool durable);
+
+    // Flushes durably and closes the file. The sequence number is kept.
+    void close();
+
+    // Empties the file (after a checkpoint) keeping the sequence number and the sync policy
+    bool restart();
+
+    // Sequence number of the last recorded operation
+    std::uint64_t last_sequence() const;
+    void set_last_sequence(std::uint64_t sequence);
+
+    // Appends a record of the operation with its integer and string arguments
+    void record(JournalOp op, std::initializer_list<std::int32_t> numbers,
+                std::initializer_list<std::string_view> strings);
+
+private:
+    std::FILE* file = nullptr;
+    std::string path;
+    std::string buffer;
+    JournalSync policy = JournalSync::Group;
+    std::size_t groupSize = 1;
+    // Records in the buffer
+    std::size_t pending = 0;
+    std::uint64_t lastSequence = 0;
+    bool writeFailed = false;
 };
 
 // This is the class you are supposed to implement
@@ -108,12 +841,17 @@ public:
     Datastructures();
     ~Datastructures();
 
+    // Indexes refer back to the object, so it can't be copied
+    Datastructures(Datastructures const&) = delete;
+    Datastructures& operator=(Datastructures const&) = delete;
+
     // Estimate of performance: O(1)
     // Short rationale for estimate: ei rekursiivinen eikä looppi
     int beacon_count();
 
-    // Estimate of performance: O(n)
-    // Short rationale for estimate: jokainen elementti postetaan yksitellen, kaikki mapit yhtä isoja
+    // Estimate of performance: O(logn)
+    // Short rationale for estimate: säiliöt rakennetaan tyhjinä uudestaan ja pooli vapauttaa
+    // muistinsa kerralla, poolin lohkojen koko kasvaa geometrisesti
     void clear_beacons();
 
     // Estimate of performance: O(n)
@@ -143,58 +881,308 @@ public:
     std::vector<BeaconID> beacons_alphabetically();
 
     // Estimate of performance: O(n)
-    // Short rationale for estimate: mapin läpikäynti O(n) ja vectorin loppuun lisäys O(1)
+    // Short rationale for estimate: ämpärit käydään läpi järjestyksessä, tyhjät ohitetaan bittiskannauksella
     std::vector<BeaconID> beacons_brightness_increasing();
 
-    // Estimate of performance: O(1)
-    // Short rationale for estimate: ei riipu majakoiden määrästä, empty() ja begin() O(1)
+    // Estimate of performance: O(1), O(logn) if some brightness is outside 0..2550
+    // Short rationale for estimate: ensimmäinen ei-tyhjä ämpäri bittiskannauksella
     BeaconID min_brightness();
 
-    // Estimate of performance: O(1)
-    // Short rationale for estimate: ei riipu majakoiden määrästä, empty() ja rbegin() O(1)
+    // Estimate of performance: O(1), O(logn) if some brightness is outside 0..2550
+    // Short rationale for estimate: viimeinen ei-tyhjä ämpäri bittiskannauksella
     BeaconID max_brightness();
 
-    // Estimate of performance: O(m+nlogn)
-    // Short rationale for estimate: mapin läpikäynti m ja paluuvectorin järjestäminen nlogn
+    // Brightness rank queries, rank 1 is the brightest beacon
+
+    // Estimate of performance: O(1), O(logn) if some brightness is outside 0..2550
+    // Short rationale for estimate: Fenwick-puun summa kiinteästä 2551 ämpäristä ja paikka ämpärissä
+    int brightness_rank(BeaconID id);
+
+    // Estimate of performance: O(1), O(logn) if some brightness is outside 0..2550
+    // Short rationale for estimate: laskeutuminen kiinteän kokoisessa Fenwick-puussa
+    BeaconID kth_brightest(int k);
+
+    // Estimate of performance: O(k), O(logn + k) if some brightness is outside 0..2550
+    // Short rationale for estimate: ensimmäisen haku Fenwick-puusta, jonka jälkeen k alkiota läpi
+    std::vector<BeaconID> brightest_beacons(int count, int offset = 0);
+
+    // Estimate of performance: O(k), O(logn + k) if some brightness is outside 0..2550
+    // Short rationale for estimate: rajojen ja ensimmäisen haku Fenwick-puusta, jonka jälkeen k alkiota läpi
+    std::vector<BeaconID> beacons_in_brightness_range(int lo, int hi, int offset = 0,
+                                                      int limit = std::numeric_limits<int>::max());
+
+    // Estimate of performance: O(logn + k)
+    // Short rationale for estimate: equal_range logn, nimi-indeksi on valmiiksi id:n mukaan järjestyksessä
     std::vector<BeaconID> find_beacons(std::string const& name);
 
-    // Estimate of performance: O(logn + m)
-    // Short rationale for estimate: equal_range logn, for looppi m, poisto n, lisäys multimappiin logn, loput O(1)
+    // Estimate of performance: O(logn + klogk)
+    // Short rationale for estimate: lower_bound logn, k osumaa läpi ja järjestetään id:n mukaan klogk
+    std::vector<BeaconID> find_beacons_prefix(std::string const& prefix);
+
+    // Estimate of performance: O(m + klogk), alle 3 merkin hakusanalla O(n)
+    // Short rationale for estimate: käydään läpi lyhin hakusanan trigrammin lista m,
+    // osumien järjestäminen klogk. Lyhyellä hakusanalla käydään nimisarake läpi
+    std::vector<BeaconID> find_beacons_substring(std::string const& part);
+
+    // Estimate of performance: O(logn + l)
+    // Short rationale for estimate: poisto ja lisäys nimi-indeksiin logn, uuden nimen trigrammit l
     bool change_beacon_name(BeaconID id, std::string const& newname);
 
-    // Estimate of performance: O(logn + m)
-    // Short rationale for estimate: equal_range logn, for looppi m, poisto n, lisäys multimappiin logn, loput O(1)
+    // Estimate of performance: O(logn + d) amortized
+    // Short rationale for estimate: poisto ja lisäys kirkkausämpäriin O(1), kirkkaus päivitetään
+    // linkki-leikkauspuuhun logn, kokonaisvärin muutos välitetään säteiden ketjua pitkin d
     bool change_beacon_color(BeaconID id, Color newcolor);
 
     // We recommend you implement the operations below only after implementing the ones above
 
-    // Estimate of performance: O(1)
-    // Short rationale for estimate: kaikki operaatiot O(1)
+    // Estimate of performance: O(logn + d), logn amortized
+    // Short rationale for estimate: silmukan tarkistus linkki-leikkauspuun juurikyselynä logn,
+    // säteen lisäys O(1), kokonaisvärin ja tulevan ketjun pituuden muutos välitetään säteiden ketjua pitkin d
     bool add_lightbeam(BeaconID sourceid, BeaconID targetid);
 
     // Estimate of performance: O(m+nlogn)
     // Short rationale for estimate: for looppi m, lajittelu nlogn
     std::vector<BeaconID> get_lightsources(BeaconID id);
 
-    // Estimate of performance: O(n)
-    // Short rationale for estimate: vectorin järjestäminen O(n)
+    // Estimate of performance: O(k)
+    // Short rationale for estimate: ketju kuljetaan kerran ja id:t lisätään vectorin loppuun, k on polun pituus
     std::vector<BeaconID> path_outbeam(BeaconID id);
 
     // Non-compulsory operations
 
-    // Estimate of performance: tiivistettynä O(logn+n)
-    // Short rationale for estimate: equal_range logn, for loopit m+n+o,
-    // poistot 1 (unordered_map) ja logn (multimap), loput O(1)
+    // Estimate of performance: tiivistettynä O(mlogn+d), O(mlogn+dk) jos pisimmät ketjut lyhenevät
+    // Short rationale for estimate: indekseistä poistot logn, omat lähteet m irrotetaan linkki-leikkauspuusta
+    // logn kukin, säteen poisto kohteelta ja kohteen pisimpien lähteiden ryhmästä O(1),
+    // kokonaisvärin muutos välitetään säteiden ketjua pitkin d; vain jos kohteen kaikki pisimmät
+    // lähteet poistuvat, ketjuaan lyhentävien kohteiden lähteet k käydään läpi
     bool remove_beacon(BeaconID id);
 
-    // Estimate of performance:
-    // Short rationale for estimate:
+    // Estimate of performance: O(k)
+    // Short rationale for estimate: seurataan pisimmän tulevan ketjun osoittimia, k on polun pituus
     std::vector<BeaconID> path_inbeam_longest(BeaconID id);
 
     // Estimate of performance: O(1)
-    // Short rationale for estimate: kaikki operaatiot O(1)
+    // Short rationale for estimate: kokonaisväri on tallessa valmiiksi laskettuna
     Color total_color(BeaconID id);
 
+    // Bulk loading
+
+    // Estimate of performance: O(klogk + klogn)
+    // Short rationale for estimate: majakat lisätään sarakkeiden loppuun O(k), uudet kahvat järjestetään
+    // kerran nimen ja kirkkauden mukaan klogk ja lisätään indekseihin järjestyksessä
+    int add_beacons(std::vector<BeaconSpec> const& specs);
+
+    // Estimate of performance: O(klogn + m), logn amortized
+    // Short rationale for estimate: säteet tarkistetaan ja silmukat hylätään klogn, vastaanottajien listat varataan laskemalla
+    // ensin säteet kohteittain, kokonaisvärit ja ketjut lasketaan kerran muuttuneille puille m
+    int add_lightbeams(std::vector<std::pair<BeaconID, BeaconID>> const& beams);
+
+    // Spatial queries. Rectangles are given by their min and max corners, both inclusive.
+
+    // Estimate of performance: O(c + klogk)
+    // Short rationale for estimate: käydään läpi suorakulmion ruudukon solut c (enintään ei-tyhjien
+    // solujen määrä) ja osumat järjestetään id:n mukaan klogk
+    std::vector<BeaconID> beacons_in_rect(Coord min, Coord max);
+
+    // Estimate of performance: O(c + k)
+    // Short rationale for estimate: käydään läpi suorakulmion ruudukon solut c ja niiden majakat k
+    int count_in_rect(Coord min, Coord max);
+
+    // Estimate of performance: O(r^2 + mlogk)
+    // Short rationale for estimate: ruudukon soluja käydään läpi renkaittain, kunnes k lähintä on varmasti
+    // löytynyt, r on renkaiden määrä. Löydetyistä m majakasta valitaan k lähintä
+    std::vector<BeaconID> nearest_beacons(Coord xy, int k);
+
+    // Zero-copy views and visitors. Views yield beacon IDs as string_views without copying them,
+    // visitors get every ID in turn and return false to stop the listing.
+
+    using IdIterator = std::pmr::vector<std::string_view>::const_iterator;
+    class AlphabeticalIterator;
+    class BrightnessIterator;
+
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: näkymä sisältää vain sarakkeen alun ja lopun
+    BeaconIdView<IdIterator> all_beacons_view() const;
+
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: näkymä sisältää vain nimi-indeksin alun ja lopun
+    BeaconIdView<AlphabeticalIterator> beacons_alphabetically_view() const;
+
+    // Estimate of performance: O(logn)
+    // Short rationale for estimate: näkymän alku on kirkkausindeksin ensimmäinen majakka
+    BeaconIdView<BrightnessIterator> beacons_brightness_increasing_view() const;
+
+    // Estimate of performance: O(n)
+    // Short rationale for estimate: id-sarake käydään läpi kerran
+    void visit_all_beacons(std::function<bool(std::string_view)> const& visit) const;
+
+    // Estimate of performance: O(n)
+    // Short rationale for estimate: nimi-indeksi käydään läpi kerran
+    void visit_beacons_alphabetically(std::function<bool(std::string_view)> const& visit) const;
+
+    // Estimate of performance: O(n)
+    // Short rationale for estimate: kirkkausindeksi käydään läpi sisäjärjestyksessä kerran
+    void visit_beacons_brightness_increasing(std::function<bool(std::string_view)> const& visit) const;
+
+    // Binary snapshot files. The file holds all beacons, beams and fibres in a versioned format
+    // with a checksum, and it is read in place from a memory mapping where possible.
+
+    // Estimate of performance: O(n + m)
+    // Short rationale for estimate: majakat ja kuidut kirjoitetaan kerran, merkkijonot perään
+    bool save_snapshot(std::string const& filename);
+
+    // Estimate of performance: O(nlogn + mlogm)
+    // Short rationale for estimate: tiedosto, id:iden yksikäsitteisyys ja säteiden silmukattomuus tarkistetaan kerran, majakat lisätään massalisäyksellä
+    // (nimi-indeksin järjestäminen nlogn) ja kuidut mappeihin mlogm
+    bool load_snapshot(std::string const& filename);
+
+    // Write-ahead journal. When a journal is open, every modifying operation is recorded before it
+    // returns, and recover() rebuilds the data from the latest snapshot file and the journal records
+    // after it. load_snapshot is refused while a journal is open, use recover() instead.
+
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: tiedosto avataan ja otsake kirjoitetaan
+    bool open_journal(std::string const& filename, JournalSync sync = JournalSync::Group, std::size_t groupSize = 64);
+
+    // Estimate of performance: O(k)
+    // Short rationale for estimate: puskurin k tietuetta kirjoitetaan ja synkronoidaan kerran
+    bool sync_journal();
+
+    // Estimate of performance: O(k)
+    // Short rationale for estimate: puskurin k tietuetta kirjoitetaan ennen sulkemista
+    void close_journal();
+
+    // Estimate of performance: O(n + m)
+    // Short rationale for estimate: tilannevedos tallennetaan väliaikaiseen tiedostoon, joka nimetään
+    // oikeaksi, minkä jälkeen päiväkirja tyhjennetään
+    bool checkpoint(std::string const& snapshotFile);
+
+    // Estimate of performance: O(nlogn + mlogm + j)
+    // Short rationale for estimate: tilannevedos ladataan ja päiväkirjan j uutta tietuetta suoritetaan
+    bool recover(std::string const& snapshotFile, std::string const& journalFile,
+                 JournalSync sync = JournalSync::Group, std::size_t groupSize = 64);
+
+    // Link-cut tree over the beams. It is always maintained for rejecting beams that would close a loop.
+    // While it is enabled find_sink, outbeam_length and the outbeam brightness queries also use it and take O(logn)
+    // amortized time, otherwise they walk the outbeam, which is faster on shallow forests. The queries
+    // restructure the tree.
+
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: puu on aina ajan tasalla, kytkin valitsee vain kyselyjen toteutuksen
+    void enable_beam_tree(bool enabled);
+
+    // Estimate of performance: O(logn) amortized when enabled, O(d) otherwise
+    // Short rationale for estimate: access ja puun vasemmanpuoleisin solmu
+    BeaconID find_sink(BeaconID id);
+
+    // Estimate of performance: O(logn) amortized when enabled, O(d) otherwise
+    // Short rationale for estimate: accessin jälkeen vasemman alipuun koko on edeltäjien määrä
+    int outbeam_length(BeaconID id);
+
+    // Estimate of performance: O(logn) amortized when enabled, O(d) otherwise
+    // Short rationale for estimate: accessin jälkeen kirkkain on splay-puun juuren koostearvossa
+    BeaconID brightest_on_outbeam(BeaconID id);
+
+    // Estimate of performance: O(logn) amortized when enabled, O(d) otherwise
+    // Short rationale for estimate: kuten brightest_on_outbeam
+    BeaconID dimmest_on_outbeam(BeaconID id);
+
+    // Estimate of performance: O(logn) amortized when enabled, O(d) otherwise
+    // Short rationale for estimate: accessin jälkeen polun summa on splay-puun juuren koostearvossa
+    std::int64_t outbeam_brightness_sum(BeaconID id);
+
+    // Binary lifting queries over the beams. The lifting table is built lazily by the queries and
+    // invalidated only for the beacons upstream of a changed beam.
+
+    // Estimate of performance: O(logn) amortized
+    // Short rationale for estimate: k:n bitit hypätään taulukosta; vanhentuneet rivit rakennetaan
+    // uudestaan vain kerran muutosten välillä
+    BeaconID kth_downstream(BeaconID id, int k);
+
+    // Estimate of performance: O(logn) amortized
+    // Short rationale for estimate: syvemmän majakan nosto samalle syvyydelle ja yhteinen nosto bitti kerrallaan
+    BeaconID first_common_receiver(BeaconID id1, BeaconID id2);
+
+    // Inbeam tree queries over an Euler tour of the beams. The tour is built by the first query and
+    // maintained after that by the operations that change beams or colors.
+
+    // Estimate of performance: O(logn) amortized, O(n) for the first query
+    // Short rationale for estimate: majakoiden merkkien sijainnit kierroksella saadaan splay-puista
+    bool is_upstream(BeaconID id1, BeaconID id2);
+
+    // Estimate of performance: O(logn) amortized, O(n) for the first query
+    // Short rationale for estimate: majakan merkkien välinen osa kierroksesta luetaan splay-puun koostearvoista
+    int inbeam_tree_size(BeaconID id);
+
+    // Estimate of performance: O(logn) amortized, O(n) for the first query
+    // Short rationale for estimate: kuten inbeam_tree_size
+    Color inbeam_tree_color_sum(BeaconID id);
+
+    // Whole-forest report for batch jobs: total color, longest inbeam length and sink of every beacon
+    // in one pass over the forest
+
+    // Estimate of performance: O(n)
+    // Short rationale for estimate: kokonaisvärit ja ketjujen pituudet ovat valmiina sarakkeissa, nielut
+    // ratkaistaan kulkemalla jokainen säde kerran
+    ForestReport forest_report();
+
+    // Estimate of performance: O(n)
+    // Short rationale for estimate: kuten forest_report, rivit kirjoitetaan suoraan tiedostoon
+    bool save_forest_report(std::string const& filename);
+
+    // Threads used when add_lightbeams and load_snapshot recompute the caches of whole trees. 0 uses
+    // the hardware concurrency and 1 computes serially. The results are the same in every case.
+
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: vain säikeiden määrä tallennetaan
+    void set_evaluator_threads(unsigned threads);
+
+    // Snapshots
+
+    // Estimate of performance: O(nlogn) when turned on, O(1) otherwise
+    // Short rationale for estimate: päälle kytkettäessä kaikki majakat ja kuidut lisätään pysyviin puihin
+    void enable_snapshots(bool enabled);
+
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: kopioidaan vain puiden juuret
+    std::shared_ptr<DataSnapshot const> snapshot();
+
+    // Generation-checked handles
+
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: yksi haku unordered_mapista
+    BeaconRef beacon_ref(BeaconID id);
+
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: slot-taulukon indeksointi ja sukupolven vertailu
+    bool is_valid(BeaconRef ref);
+
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: tarkistus is_validilla ja sarakkeen indeksointi
+    BeaconID get_id(BeaconRef ref);
+
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: tarkistus is_validilla ja sarakkeen indeksointi
+    std::string get_name(BeaconRef ref);
+
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: tarkistus is_validilla ja sarakkeen indeksointi
+    Coord get_coordinates(BeaconRef ref);
+
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: tarkistus is_validilla ja sarakkeen indeksointi
+    Color get_color(BeaconRef ref);
+
+    // Allocation counters of the beacon and fibre containers
+
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: laskurit luetaan suoraan
+    AllocationStats beacon_allocation_stats();
+
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: laskurit luetaan suoraan
+    AllocationStats fibre_allocation_stats();
+
     // Phase 2 operations
 
     // Estimate of performance: O(nlogn)
@@ -218,8 +1206,9 @@ public:
     // Short rationale for estimate: erase:t O(n)
     bool remove_fibre(Coord xpoint1, Coord xpoint2);
 
-    // Estimate of performance: O(2n)
-    // Short rationale for estimate: jokainen elementti poistetaan yksitellen molemmista mapeista
+    // Estimate of performance: O(logn)
+    // Short rationale for estimate: mapit rakennetaan tyhjinä uudestaan ja pooli vapauttaa
+    // muistinsa kerralla, poolin lohkojen koko kasvaa geometrisesti
     void clear_fibres();
 
     // Estimate of performance: O(n^x + m)
@@ -246,29 +1235,265 @@ public:
 
 private:
 
+    // Funktio majakan kahvan hakemiseen id:n perusteella, palauttaa NO_HANDLE jos majakkaa ei ole
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: yksi haku unordered_mapista
+    BeaconHandle find_handle(BeaconID const& id) const;
+
     // Funktio majakan kirkkauden päivittämiseen manuaalisesti
     // Estimate of performance: O(1)
     // Short rationale for estimate: suoritetaan O(1) operaatiot vain yhdelle alkiolle
-    void update_brightness(BeaconID id);
+    void update_brightness(BeaconHandle handle);
+
+    // Funktio majakkaketjun kulkemiseen linkkisaraketta (sending tai longestSources) pitkin ilman rekursiota.
+    // visit saa majakan sarakeindeksin ja palauttaa false, jos kulkeminen lopetetaan.
+    // Estimate of performance: O(k)
+    // Short rationale for estimate: jokainen ketjun majakka käydään kerran, k on ketjun pituus
+    template <typename Visit>
+    void walk_chain(BeaconHandle handle, std::pmr::vector<BeaconHandle> BeaconColumns::* links, Visit visit);
 
-    // Rekursiivinen funktio valonsäteiden selvittämiseen
+    // Funktio majakan tulevien säteiden puun läpikäyntiin jälkijärjestyksessä eksplisiittisellä pinolla.
+    // visit saa majakan sarakeindeksin vasta, kun kaikki sen lähteet on käyty.
     // Estimate of performance: O(n)
-    // Short rationale for estimate: rekursiivinen funktio, jossa alkioita lisätään vectorin loppuun O(1)
-    std::vector<BeaconID> path_recursive(BeaconID);
+    // Short rationale for estimate: jokainen puun majakka lisätään pinoon ja poistetaan kerran
+    template <typename Visit>
+    void walk_inbeam_postorder(BeaconHandle root, Visit visit);
+
+    // Sama annetulla pinolla, jotta rinnakkaiset säikeet voivat kulkea eri alipuita yhtä aikaa
+    template <typename Visit>
+    void walk_inbeam_postorder(BeaconHandle root, std::pmr::vector<std::pair<BeaconHandle, std::uint32_t>>& stack,
+                               Visit visit) const;
+
+    // Funktio kokonaisvärien ja pisimpien tulevien ketjujen laskemiseen koko puulle alusta. Suuret puut
+    // jaetaan erillisiin alipuihin, jotka lasketaan rinnakkain.
+    // Estimate of performance: O(n), O(n/p + t) with p threads
+    // Short rationale for estimate: jälkijärjestyksessä jokainen majakka lasketaan lähteidensä valmiista arvoista,
+    // puun yläosa t lasketaan leveyssuunnassa yhdellä säikeellä
+    void recompute_inbeam_caches(BeaconHandle root);
+
+    // Funktio yhden majakan kokonaisvärin ja pisimmän tulevan ketjun laskemiseen lähteiden valmiista arvoista
+    // Estimate of performance: O(k)
+    // Short rationale for estimate: k on majakan lähteiden määrä
+    void compute_inbeam_cache(std::uint32_t d);
+
+    // Funktio majakan lisäämiseen sarakkeisiin ilman nimi- ja kirkkausindeksejä
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: lisäykset vectorien loppuun ja unordered_mapiin O(1)
+    BeaconHandle append_beacon(std::string_view id, std::string_view name, Coord xy, Color color);
 
-    // Rekursiivinen funktio majakoiden värien laskemiseen
+    // Funktio sarakkeiden ja id-hakemiston varaamiseen annetulle majakkamäärälle
     // Estimate of performance: O(n)
-    // Short rationale for estimate: rekursiivinen funktio, jossa mahdollisen vectorin läpikäynti O(n) ja laskutoimitukset O(1)
-    Color color_recursive(BeaconID);
+    // Short rationale for estimate: sarakkeet voivat joutua siirtymään uuteen muistiin
+    void reserve_beacons(std::size_t newSize);
+
+    // Funktio sarakkeiden loppuun lisättyjen majakoiden lisäämiseen nimi- ja kirkkausindekseihin
+    // Estimate of performance: O(klogk)
+    // Short rationale for estimate: uudet majakat järjestetään nimen mukaan klogk ja lisätään
+    // nimi-indeksiin vihjeen kanssa, kirkkausämpäreihin lisäys O(1)
+    void index_new_beacons(std::pmr::vector<BeaconHandle>& added);
+
+    // Funktio hyväksyttyjen säteiden linkittämiseen ja muuttuneiden puiden välimuistien laskemiseen
+    // Estimate of performance: O(n + m)
+    // Short rationale for estimate: kohteiden lähdemäärät lasketaan sarakkeen kokoiseen vektoriin n,
+    // muuttuneiden puiden kokonaisvärit ja ketjut lasketaan kerran m
+    void link_new_beams(std::pmr::vector<std::pair<BeaconHandle, BeaconHandle>> const& accepted);
+
+    // Funktio säteen lisäämiseen lähteen ja kohteen linkkeihin ilman kokonaisvärin ja ketjun päivitystä
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: lisäys vectorin loppuun ja indeksien asetus
+    void link_beam(BeaconHandle source, BeaconHandle target);
+
+    // Funktio majakan kokonaisvärin päivittämiseen ja muutoksen välittämiseen valon kohteille
+    // Estimate of performance: O(d)
+    // Short rationale for estimate: kuljetaan lähtevien säteiden ketjua niin kauan kuin kokonaisväri muuttuu
+    void update_total_color(BeaconHandle handle);
+
+    // Funktio pisimmän tulevan ketjun päivittämiseen, kun majakan viimeinen pisimmän ketjun lähde on poistunut
+    // Estimate of performance: O(dk)
+    // Short rationale for estimate: lasketaan uudestaan vain ne kohteet, joiden pisin ketju lyhenee,
+    // jokaisen lähteet k käydään läpi
+    void update_inbeam_height(BeaconHandle handle);
+
+    // Funktio majakan pisimmän tulevan ketjun ja pisimpien lähteiden ryhmän laskemiseen lähteiden korkeuksista
+    // Estimate of performance: O(k)
+    // Short rationale for estimate: lähteet käydään läpi kahdesti, k on lähteiden määrä
+    void rebuild_longest_sources(std::uint32_t d);
+
+    // Funktio lähteen liittämiseen kohteen pisimpien lähteiden ryhmään, kun lähteen ketju on kasvanut.
+    // Palauttaa true, jos kohteen oma ketju kasvoi.
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: lähde vaihdetaan ryhmän reunalle sijaintinsa avulla
+    bool join_longest_sources(std::uint32_t t, BeaconHandle source);
+
+    // Funktio lähteen poistamiseen kohteen pisimpien lähteiden ryhmästä. Palauttaa true, jos ryhmä tyhjeni
+    // ja kohteen ketju on laskettava uudestaan.
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: lähde vaihdetaan ryhmän viimeisen kanssa
+    bool leave_longest_sources(std::uint32_t t, BeaconHandle source);
+
+    // Funktio kahden lähteen paikan vaihtamiseen kohteen lähdelistassa
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: paikat ja lähteiden sijainnit päivitetään suoraan
+    void swap_sources(std::uint32_t t, std::uint32_t pos1, std::uint32_t pos2);
+
+    // Funktio majakan sarakeindeksin hakemiseen kahvan perusteella
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: slot-taulukon indeksointi
+    std::uint32_t dense_index(BeaconHandle handle) const;
 
-    // Unordered_map for saving all beacons' data
-    std::unordered_map<BeaconID, Beacon> allBeacons;
+    // Funktio majakan lisäämiseen ruudukon soluun
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: solun haku unordered_mapista ja lisäys vectorin loppuun
+    void add_to_grid(BeaconHandle handle);
 
-    // Map for arranging beacons by name
-    std::multimap<std::string, BeaconID> beaconNames;
+    // Funktio majakan poistamiseen ruudukon solusta
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: solun viimeinen majakka siirretään poistettavan paikalle
+    void remove_from_grid(std::uint32_t d);
 
-    // Map for arranging beacons by brightness
-    std::multimap<int, BeaconID> beaconBrightnesses;
+    // Funktio suorakulmion majakoiden läpikäyntiin. visit saa jokaisen suorakulmiossa olevan majakan
+    // sarakeindeksin. Jos suorakulmiossa on enemmän soluja kuin ei-tyhjiä soluja, käydään solut läpi.
+    // Estimate of performance: O(c + k)
+    // Short rationale for estimate: solut c käydään läpi kerran ja niiden majakat k tarkistetaan
+    template <typename Visit>
+    void visit_rect(Coord min, Coord max, Visit visit);
+
+    // Funktio majakan tietojen päivittämiseen nykyiseen versioon, kun versiointi on päällä
+    // Estimate of performance: O(logn)
+    // Short rationale for estimate: polun kopiointi pysyvässä puussa
+    void update_snapshot_beacon(std::uint32_t d);
+
+    // Funktio, joka kertoo sulkisiko säde lähteestä kohteeseen silmukan. Lähde ei lähetä valoa.
+    // Estimate of performance: O(1) jos lähteellä ei ole lähteitä, muuten O(logn) amortized
+    // Short rationale for estimate: lähteettömän lähteen puussa ei ole muita majakoita, muuten juurikysely
+    bool closes_loop(BeaconHandle source, BeaconHandle target);
+
+    // Funktio jokaisen majakan lähtevän säteen ketjun nielun tiheän indeksin laskemiseen
+    // Estimate of performance: O(n)
+    // Short rationale for estimate: jokaisen majakan nielu asetetaan kerran, ketjua kuljetaan vain tuntemattomien yli
+    std::vector<std::uint32_t> sink_indices() const;
+
+    // Funktio Euler-kierroksen rakentamiseen ensimmäisellä kyselyllä
+    // Estimate of performance: O(n)
+    // Short rationale for estimate: jokainen puu kierretään kerran ja sen splay-puu rakennetaan järjestyksestä
+    void prepare_euler_tour();
+
+    // Funktio nostotaulukon koon tarkistamiseen ennen kyselyä; jos tasoja tarvitaan lisää, kaikki rivit mitätöidään
+    // Estimate of performance: O(1) amortized
+    // Short rationale for estimate: taulukko kasvaa kahvojen mukana, tasot lisääntyvät vain majakkamäärän tuplaantuessa
+    void prepare_lift_index();
+
+    // Funktio majakan nostotaulukon rivin laskemiseen. Vanhentuneet rivit lasketaan ylhäältä alaspäin.
+    // Estimate of performance: O(klogn)
+    // Short rationale for estimate: k vanhentunutta majakkaa kohteiden suunnassa, jokaiselle logn tasoa
+    void ensure_lift(BeaconHandle handle);
+
+    // Funktio majakan ja sen lähteiden (tulevien säteiden puun) nostotaulukon rivien mitätöintiin
+    // Estimate of performance: O(k)
+    // Short rationale for estimate: vain voimassa olevat rivit käydään läpi, mitätöidyn alipuu on jo mitätöity
+    void invalidate_lift(BeaconHandle handle);
+
+    // Funktio id:n merkkien kopioimiseen majakoiden muistiin
+    // Estimate of performance: O(l)
+    // Short rationale for estimate: id:n merkit kopioidaan kerran
+    std::string_view intern_id(std::string_view id);
+
+    // Memory of all beacon containers. The pool reuses freed blocks of the same size
+    // and releases all of its memory at once when the beacons are cleared.
+    std::pmr::unsynchronized_pool_resource beaconPool;
+    CountingResource beaconMemory{&beaconPool};
+
+    // Unordered_map for interning beacon IDs into handles, each ID is stored only once
+    std::pmr::unordered_map<std::string_view, BeaconHandle> beaconHandles{&beaconMemory};
+
+    // Slot table, indexed by handle
+    std::pmr::vector<BeaconSlot> beaconSlots{&beaconMemory};
+
+    // Slots of removed beacons, reused by add_beacon
+    std::pmr::vector<BeaconHandle> freeSlots{&beaconMemory};
+
+    // All beacons' data in contiguous columns
+    BeaconColumns beacons{&beaconMemory};
+
+    // Ordering for the name index: by name, equal names by ID. Also compares
+    // handles directly against names so that the index can be searched by name.
+    struct NameOrder
+    {
+        using is_transparent = void;
+        Datastructures const* ds;
+        bool operator()(BeaconHandle h1, BeaconHandle h2) const;
+        bool operator()(BeaconHandle h, std::string_view name) const;
+        bool operator()(std::string_view name, BeaconHandle h) const;
+    };
+
+    // Funktio nimen trigrammien lisäämiseen hakemistoon
+    // Estimate of performance: O(l)
+    // Short rationale for estimate: jokainen nimen kolmen merkin jono lisätään kerran
+    void add_name_trigrams(BeaconHandle handle, std::string_view name);
+
+    // Funktio trigrammihakemiston rakentamiseen uudestaan ilman vanhentuneita alkioita
+    // Estimate of performance: O(nl)
+    // Short rationale for estimate: jokaisen majakan nimen trigrammit lisätään
+    void rebuild_name_trigrams();
+
+    // Set for arranging beacons by name
+    std::pmr::set<BeaconHandle, NameOrder> beaconNames{NameOrder{this}, &beaconMemory};
+
+    // Trigram index of beacon names for substring search. Entries of removed or renamed
+    // beacons are left in the lists and filtered out when searching.
+    std::pmr::unordered_map<std::uint32_t, std::pmr::vector<BeaconHandle>> nameTrigrams{&beaconMemory};
+
+    // Scratch vector for the trigrams of one name
+    std::pmr::vector<std::uint32_t> trigramScratch{&beaconMemory};
+
+    // Number of outdated entries in nameTrigrams and number of all entries
+    std::size_t staleTrigrams = 0;
+    std::size_t totalTrigrams = 0;
+
+    // Index for arranging beacons by brightness
+    BrightnessIndex beaconBrightnesses{&beaconMemory};
+
+    // Version that snapshot() hands out. Only maintained when snapshots are enabled; the persistent
+    // trees use the global allocator because readers may free their nodes from other threads.
+    bool snapshotsEnabled = false;
+    DataSnapshot currentVersion;
+
+    // Journal of modifying operations, records are written only while it is open
+    Journal journal;
+
+    // Binary lifting table over the beams, indexed by handle: liftTable[handle * liftLevels + j] is the
+    // beacon 2^j hops downstream. A row is valid only if the rows of all beacons downstream of it are
+    // valid, so invalidating a beacon invalidates its whole inbeam tree. Maintained once a query has used it.
+    bool liftIndexUsed = false;
+    std::size_t liftLevels = 0;
+    std::pmr::vector<std::uint8_t> liftValid{&beaconMemory};
+    std::pmr::vector<std::uint32_t> liftDepths{&beaconMemory};
+    std::pmr::vector<BeaconHandle> liftTable{&beaconMemory};
+    std::pmr::vector<BeaconHandle> liftStack{&beaconMemory};
+
+    // Euler tour of the beams, maintained once a query has built it
+    bool eulerTourUsed = false;
+    BeamEulerTour eulerTour{&beaconMemory};
+
+    // Link-cut tree of the beams, always maintained for the loop check; the flag selects whether queries use it
+    bool beamTreeEnabled = false;
+    BeamLinkCutTree beamTree{&beaconMemory};
+
+    // Uniform grid over beacon coordinates for spatial queries. Only non-empty cells are stored,
+    // keyed by the packed cell coordinates.
+    std::pmr::unordered_map<std::uint64_t, std::pmr::vector<BeaconHandle>> gridCells{&beaconMemory};
+
+    // Threads for recompute_inbeam_caches, 0 for the hardware concurrency. A tree is split for the threads
+    // only if its top levels have at least PARALLEL_MIN_SUBTREES separate subtrees before the top grows
+    // over PARALLEL_MAX_TOP beacons; the threads take PARALLEL_CHUNK subtrees at a time.
+    unsigned evaluatorThreads = 0;
+    static constexpr std::size_t PARALLEL_MIN_SUBTREES = 16384;
+    static constexpr std::size_t PARALLEL_MAX_TOP = 65536;
+    static constexpr std::size_t PARALLEL_CHUNK = 64;
+
+    // Scratch stack for walk_inbeam_postorder (beacon, index of the next source to visit),
+    // kept between calls so that traversals don't allocate
+    std::pmr::vector<std::pair<BeaconHandle, std::uint32_t>> traversalStack{&beaconMemory};
 
     // Estimate of performance: O(n^x)
     // Short rationale for estimate: käydään n alkioiden kohdalla m alkioisia listoja läpi
@@ -278,12 +1503,161 @@ private:
     // Short rationale for estimate: kaikki operaatiot O(1)
     std::pair<Coord, Coord> swapCoords(std::pair<Coord, Coord> point);
 
+    // Memory of the fibre maps, released at once when the fibres are cleared
+    std::pmr::unsynchronized_pool_resource fibrePool;
+    CountingResource fibreMemory{&fibrePool};
+
     // Map for saving fibre coordpairs and costs
-    std::map<std::pair<Coord, Coord>, Cost> fibreCoords;
+    std::pmr::map<std::pair<Coord, Coord>, Cost> fibreCoords{&fibreMemory};
 
     // Map for saving Xpoints
-    std::map<Coord, Xpoint> allFibres;
+    std::pmr::map<Coord, Xpoint> allFibres{&fibreMemory};
+
+};
+
+// Iterator of the name index view
+class Datastructures::AlphabeticalIterator
+{
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = std::string_view;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = std::string_view;
+
+    AlphabeticalIterator(Datastructures const* ds, std::pmr::set<BeaconHandle, NameOrder>::const_iterator it)
+        : ds(ds), it(it) {}
 
+    std::string_view operator*() const { return ds->beacons.ids[ds->dense_index(*it)]; }
+    AlphabeticalIterator& operator++() { ++it; return *this; }
+    AlphabeticalIterator operator++(int) { auto old = *this; ++it; return old; }
+    bool operator==(AlphabeticalIterator const& other) const { return it == other.it; }
+    bool operator!=(AlphabeticalIterator const& other) const { return it != other.it; }
+
+private:
+    Datastructures const* ds;
+    std::pmr::set<BeaconHandle, NameOrder>::const_iterator it;
+};
+
+// Iterator of the brightness index view, the end iterator has handle NO_HANDLE
+class Datastructures::BrightnessIterator
+{
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = std::string_view;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = std::string_view;
+
+    BrightnessIterator(Datastructures const* ds, BeaconHandle handle)
+        : ds(ds), handle(handle) {}
+
+    std::string_view operator*() const { return ds->beacons.ids[ds->dense_index(handle)]; }
+    BrightnessIterator& operator++() { handle = ds->beaconBrightnesses.next(handle); return *this; }
+    BrightnessIterator operator++(int) { auto old = *this; ++*this; return old; }
+    bool operator==(BrightnessIterator const& other) const { return handle == other.handle; }
+    bool operator!=(BrightnessIterator const& other) const { return handle != other.handle; }
+
+private:
+    Datastructures const* ds;
+    BeaconHandle handle;
+};
+
+// Thread-safe facade over Datastructures. Read-only queries take a shared lock and run concurrently,
+// operations that modify the data take an exclusive lock and are serialized. The cost of each operation
+// is that of the corresponding Datastructures operation plus locking.
+class ConcurrentDatastructures
+{
+public:
+    // Read-only queries (shared lock)
+    int beacon_count();
+    std::vector<BeaconID> all_beacons();
+    std::string get_name(BeaconID id);
+    Coord get_coordinates(BeaconID id);
+    Color get_color(BeaconID id);
+    std::vector<BeaconID> beacons_alphabetically();
+    std::vector<BeaconID> beacons_brightness_increasing();
+    BeaconID min_brightness();
+    BeaconID max_brightness();
+    int brightness_rank(BeaconID id);
+    BeaconID kth_brightest(int k);
+    std::vector<BeaconID> brightest_beacons(int count, int offset = 0);
+    std::vector<BeaconID> beacons_in_brightness_range(int lo, int hi, int offset = 0,
+                                                      int limit = std::numeric_limits<int>::max());
+    std::vector<BeaconID> find_beacons(std::string const& name);
+    std::vector<BeaconID> find_beacons_prefix(std::string const& prefix);
+    std::vector<BeaconID> find_beacons_substring(std::string const& part);
+    std::vector<BeaconID> get_lightsources(BeaconID id);
+    std::vector<BeaconID> path_outbeam(BeaconID id);
+    std::vector<BeaconID> path_inbeam_longest(BeaconID id);
+    Color total_color(BeaconID id);
+    std::vector<BeaconID> beacons_in_rect(Coord min, Coord max);
+    int count_in_rect(Coord min, Coord max);
+    std::vector<BeaconID> nearest_beacons(Coord xy, int k);
+    void visit_all_beacons(std::function<bool(std::string_view)> const& visit);
+    void visit_beacons_alphabetically(std::function<bool(std::string_view)> const& visit);
+    void visit_beacons_brightness_increasing(std::function<bool(std::string_view)> const& visit);
+    BeaconRef beacon_ref(BeaconID id);
+    bool is_valid(BeaconRef ref);
+    BeaconID get_id(BeaconRef ref);
+    std::string get_name(BeaconRef ref);
+    Coord get_coordinates(BeaconRef ref);
+    Color get_color(BeaconRef ref);
+    AllocationStats beacon_allocation_stats();
+    AllocationStats fibre_allocation_stats();
+    std::vector<Coord> all_xpoints();
+    std::vector<std::pair<Coord, Cost>> get_fibres_from(Coord xpoint);
+    std::vector<std::pair<Coord, Coord>> all_fibres();
+    std::vector<std::pair<Coord, Cost>> route_any(Coord fromxpoint, Coord toxpoint);
+    std::vector<std::pair<Coord, Cost>> route_least_xpoints(Coord fromxpoint, Coord toxpoint);
+    std::vector<std::pair<Coord, Cost>> route_fastest(Coord fromxpoint, Coord toxpoint);
+    std::vector<Coord> route_fibre_cycle(Coord startxpoint);
+
+    // Consistent version for long reads, which then need no lock at all
+    std::shared_ptr<DataSnapshot const> snapshot();
+    bool save_snapshot(std::string const& filename);
+    ForestReport forest_report();
+    bool save_forest_report(std::string const& filename);
+
+    // Modifying operations (exclusive lock)
+    void clear_beacons();
+    bool add_beacon(BeaconID id, std::string const& name, Coord xy, Color color);
+    bool change_beacon_name(BeaconID id, std::string const& newname);
+    bool change_beacon_color(BeaconID id, Color newcolor);
+    bool add_lightbeam(BeaconID sourceid, BeaconID targetid);
+    bool remove_beacon(BeaconID id);
+    int add_beacons(std::vector<BeaconSpec> const& specs);
+    int add_lightbeams(std::vector<std::pair<BeaconID, BeaconID>> const& beams);
+    bool add_fibre(Coord xpoint1, Coord xpoint2, Cost cost);
+    bool remove_fibre(Coord xpoint1, Coord xpoint2);
+    void clear_fibres();
+    Cost trim_fibre_network();
+    void enable_snapshots(bool enabled);
+    void set_evaluator_threads(unsigned threads);
+    // The link-cut tree queries restructure the tree, so they also take the exclusive lock
+    void enable_beam_tree(bool enabled);
+    BeaconID find_sink(BeaconID id);
+    int outbeam_length(BeaconID id);
+    BeaconID brightest_on_outbeam(BeaconID id);
+    BeaconID dimmest_on_outbeam(BeaconID id);
+    std::int64_t outbeam_brightness_sum(BeaconID id);
+    // The lifting table and the Euler tour are built lazily and splayed by the queries, so they take the exclusive lock too
+    BeaconID kth_downstream(BeaconID id, int k);
+    BeaconID first_common_receiver(BeaconID id1, BeaconID id2);
+    bool is_upstream(BeaconID id1, BeaconID id2);
+    int inbeam_tree_size(BeaconID id);
+    Color inbeam_tree_color_sum(BeaconID id);
+    bool load_snapshot(std::string const& filename);
+    bool open_journal(std::string const& filename, JournalSync sync = JournalSync::Group, std::size_t groupSize = 64);
+    bool sync_journal();
+    void close_journal();
+    bool checkpoint(std::string const& snapshotFile);
+    bool recover(std::string const& snapshotFile, std::string const& journalFile,
+                 JournalSync sync = JournalSync::Group, std::size_t groupSize = 64);
+
+private:
+    std::shared_mutex mutex;
+    Datastructures ds;
 };
 
 #endif // DATASTRUCTURES_HH
@@ -12,7 +12,7 @@
 
 QT       += core gui
 
-CONFIG += c++1z warn_on
+CONFIG += c++1z warn_on thread
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
@@ -0,0 +1,84 @@
+// Standalone regression check for the binary-lifting index behind kth_downstream and
+// first_common_receiver. Beacons and beams are added between lift queries, so the index has to
+// cope with handles it has not been built for yet.
+//
+// Compile from the prg2 directory, for example:
+//   g++ -std=c++17 -O1 -D_GLIBCXX_ASSERTIONS -pthread -fPIC -I. $(pkg-config --cflags --libs Qt5Core)
+//       regression/lift_index.cc datastructures.cc -o lift_index
+
+#include "datastructures.hh"
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace
+{
+int failures = 0;
+
+void expect(bool condition, std::string const& what)
+{
+    if (!condition) {
+        std::cerr << "FAILED: " << what << std::endl;
+        ++failures;
+    }
+}
+
+void add(Datastructures& ds, BeaconID const& id)
+{
+    ds.add_beacon(id, id, {1, 1}, {1, 1, 1});
+}
+}
+
+int main()
+{
+    // Beams added between lift queries, one of them from a beacon the index has never seen
+    {
+        Datastructures ds;
+        add(ds, "A");
+        add(ds, "B");
+        expect(ds.kth_downstream("A", 1) == NO_ID, "A has no receiver yet");
+        add(ds, "N");
+        expect(ds.add_lightbeam("N", "A"), "add N->A");
+        expect(ds.add_lightbeam("A", "B"), "add A->B after a query");
+        expect(ds.kth_downstream("N", 2) == "B", "N reaches B in two steps");
+        expect(ds.first_common_receiver("N", "B") == "B", "B receives both N and B");
+    }
+
+    // Several beacons and beams between queries, with removals in between
+    {
+        Datastructures ds;
+        std::vector<BeaconID> ids;
+        for (int i = 0; i < 8; ++i) {
+            ids.push_back("c" + std::to_string(i));
+            add(ds, ids.back());
+        }
+        for (int i = 1; i < 8; ++i) {
+            ds.add_lightbeam(ids[i], ids[i - 1]);
+        }
+        expect(ds.kth_downstream("c7", 7) == "c0", "chain of eight");
+        for (int i = 0; i < 4; ++i) {
+            BeaconID id = "d" + std::to_string(i);
+            add(ds, id);
+            ds.add_lightbeam(id, i == 0 ? BeaconID("c7") : "d" + std::to_string(i - 1));
+        }
+        add(ds, "root");
+        ds.add_lightbeam("c0", "root");
+        expect(ds.kth_downstream("d3", 12) == "root", "d3 reaches the new root");
+        expect(ds.first_common_receiver("d3", "c2") == "c2", "c2 is downstream of d3");
+        ds.remove_beacon("c4");
+        add(ds, "e");
+        ds.add_lightbeam("e", "c3");
+        ds.add_lightbeam("c5", "e");
+        expect(ds.kth_downstream("d0", 4) == "e", "d0 goes through e after c4 is removed");
+        expect(ds.kth_downstream("d0", 5) == "c3", "e sends to c3");
+        expect(ds.first_common_receiver("d1", "c1") == "c1", "c1 is downstream of d1");
+    }
+
+    if (failures != 0) {
+        return EXIT_FAILURE;
+    }
+    std::cout << "lift index ok" << std::endl;
+    return EXIT_SUCCESS;
+}